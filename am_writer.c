@@ -0,0 +1,132 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "assembler.h"
+
+/*
+ * Creates the file like fopen(path, "w") would. A batch is never bigger than
+ * the system allows for one writev().
+ */
+am_writer *open_am_writer(const char *path, const text_buffer *expanded)
+{
+    am_writer *am = my_malloc(sizeof(am_writer));
+    long limit = sysconf(_SC_IOV_MAX);
+
+    am->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (am->fd < 0)
+    {
+        free(am);
+        errors_table(FAILED_TO_OPEN_FILE, -1);
+        fatal_exit(); /* Exit the program (or give up the file, in the library) */
+        return NULL;
+    }
+
+    am->expanded = expanded;
+    am->count = 0;
+    am->batch = limit > 0 && limit < AM_WRITE_BATCH ? limit : AM_WRITE_BATCH;
+    am->failed = false;
+    return am;
+}
+
+/*
+ * Text right after the last piece of the expanded source only makes that piece longer,
+ * so consecutive lines of the source are written as one piece.
+ */
+void add_am_piece(am_writer *am, const char *text, long offset, long length)
+{
+    am_piece *last = am->count > 0 ? &am->pieces[am->count - 1] : NULL;
+
+    if (length <= 0)
+    {
+        return;
+    }
+
+    if (text == NULL && last != NULL && last->text == NULL && last->offset + last->length == offset)
+    {
+        last->length += length;
+        return;
+    }
+
+    if (am->count == am->batch)
+    {
+        flush_am_writer(am);
+    }
+
+    am->pieces[am->count].text = text;
+    am->pieces[am->count].offset = offset;
+    am->pieces[am->count].length = length;
+    am->count++;
+}
+
+/*
+ * The pieces in the expanded source get their address only now, since the buffer
+ * moves when it grows. A short write goes on from where it stopped.
+ */
+void flush_am_writer(am_writer *am)
+{
+    struct iovec vectors[AM_WRITE_BATCH];
+    int i, first = 0;
+    ssize_t written;
+
+    for (i = 0; i < am->count; i++)
+    {
+        vectors[i].iov_base = (void *)(am->pieces[i].text != NULL ? am->pieces[i].text : am->expanded->text + am->pieces[i].offset);
+        vectors[i].iov_len = am->pieces[i].length;
+    }
+
+    while (!am->failed && first < am->count)
+    {
+        written = writev(am->fd, vectors + first, am->count - first);
+        if (written < 0)
+        {
+            am->failed = errno != EINTR;
+            continue;
+        }
+
+        /* Skip the pieces written whole, and the written start of the next one */
+        for (; first < am->count && (size_t)written >= vectors[first].iov_len; first++)
+        {
+            written -= vectors[first].iov_len;
+        }
+        if (first < am->count)
+        {
+            vectors[first].iov_base = (char *)vectors[first].iov_base + written;
+            vectors[first].iov_len -= written;
+        }
+    }
+
+    am->count = 0;
+}
+
+/*
+ * Writes what is left, then closes the file. A write that failed on the way
+ * left the file short, so the caller fails the file and removes it.
+ */
+bool close_am_writer(am_writer *am)
+{
+    bool written;
+
+    flush_am_writer(am);
+    written = close(am->fd) == 0 && !am->failed;
+    free(am);
+
+    if (!written)
+    {
+        errors_table(FAILED_TO_WRITE_FILE, -1);
+    }
+
+    return written;
+}
+
+/*
+ * The caller deletes the file, so nothing is reported.
+ */
+void discard_am_writer(am_writer *am)
+{
+    close(am->fd);
+    free(am);
+}
@@ -1,4 +1,12 @@
 #include "assembler.h"
+#include "batch.h"
+#include "server.h"
+#include "cache.h"
+#include "watch.h"
+#include "manifest.h"
+#include "pipeline.h"
+#include "link.h"
+#include "macro_library.h"
 
 /**
  * @brief Main entry point of the assembler program.
@@ -8,82 +16,436 @@
  * runs pre-processing, performs the first and second passes,
  * and then handles the final translation.
  *
+ * With "-j N" the files are assembled by N worker threads,
+ * and the messages of each file are printed as one block, in the given order.
+ * With a single file, its source is preprocessed by N threads when it is large.
+ * Under "make -j", the workers take their tokens from make's jobserver.
+ * "--server SOCKET" runs the assembler as a daemon on a UNIX socket,
+ * and "--connect SOCKET" sends the files to such a daemon instead of assembling them here.
+ * "--cache DIR" restores the results of unchanged sources from a content addressed cache.
+ * "--watch" keeps running, and reassembles every file whose .as file is saved.
+ * "--check" only reports the errors: the commands are not encoded and no file is written.
+ * "--max-errors N" stops assembling a file as soon as it has N errors.
+ * "--keep-am" also writes the macro expanded source of every file to its .am file.
+ * "--pipeline" runs the preprocessor, the passes and the output of consecutive files
+ * at the same time, each stage on its own thread.
+ * "--link NAME" assembles the files as the modules of one program, resolving the
+ * .extern labels of every module to the .entry labels of the others, and writes NAME.ob and NAME.ent.
+ * A single "-" reads the source from stdin and writes the output to stdout,
+ * in sections tagged ".ob", ".ent" and ".ext"; the messages then go to stderr.
+ * "--compile-macros NAME" compiles the macros of NAME.as into the macro library NAME.mch,
+ * and "--macros FILE" maps such a library, whose macros every file can then call.
+ * "@FILE" and "--manifest FILE" read more file names from a manifest, one per line.
+ * The command line files are assembled first, then the manifest entries as they are read.
+ *
  * @param argc Number of command line arguments.
- * @param argv Array of command line argument strings (input filenames).
+ * @param argv Array of command line argument strings (options and input filenames).
  * @return int Returns 0 on success, or non-zero on failure.
  */
 int main(int argc, char **argv)
 {
-    int i;
+    int i, jobs = 1, file_count = 0, manifest_count = 0, file_capacity = argc, result = 0;
+    char *server_socket = NULL, *client_socket = NULL, *program_name = NULL;
+    char *library_source = NULL, *library_path = NULL;
+    macro_library *library = NULL;
+    bool watch = false, pipelined = false;
+    char **files = my_malloc(sizeof(char *) * argc);
+    char **manifests = my_malloc(sizeof(char *) * argc);
+    int argv_file_count;
+
+    for (i = 1; i < argc; i++)
+    {
+        /* "-j N" or "-jN" sets the number of worker threads */
+        if (strncmp(argv[i], "-j", 2) == 0)
+        {
+            char *value = argv[i][2] != '\0' ? argv[i] + 2 : (i + 1 < argc ? argv[++i] : "");
+
+            jobs = atoi(value);
+            if (jobs < 1)
+            {
+                printf("Invalid number of jobs: %s\n", value);
+                free(files);
+                free(manifests);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+        {
+            server_socket = argv[++i];
+        }
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+        {
+            client_socket = argv[++i];
+        }
+        else if (strcmp(argv[i], "--link") == 0 && i + 1 < argc)
+        {
+            program_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compile-macros") == 0 && i + 1 < argc)
+        {
+            library_source = argv[++i];
+        }
+        else if (strcmp(argv[i], "--macros") == 0 && i + 1 < argc)
+        {
+            library_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--watch") == 0)
+        {
+            watch = true;
+        }
+        else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        {
+            set_cache_directory(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-errors") == 0 && i + 1 < argc)
+        {
+            default_options.max_errors = atoi(argv[++i]);
+            if (default_options.max_errors < 1)
+            {
+                printf("Invalid number of errors: %s\n", argv[i]);
+                free(files);
+                free(manifests);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--check") == 0)
+        {
+            default_options.check_only = true;
+        }
+        else if (strcmp(argv[i], "--keep-am") == 0)
+        {
+            default_options.keep_am = true;
+        }
+        else if (strcmp(argv[i], "--pipeline") == 0)
+        {
+            pipelined = true;
+        }
+        else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc)
+        {
+            manifests[manifest_count++] = argv[++i];
+        }
+        else if (argv[i][0] == '@' && argv[i][1] != '\0')
+        {
+            manifests[manifest_count++] = argv[i] + 1;
+        }
+        else
+        {
+            files[file_count++] = argv[i];
+        }
+    }
+
+    argv_file_count = file_count;
+
+    /* The library is compiled before the files that may use it */
+    if (library_source != NULL && !compile_macro_library(library_source))
+    {
+        printf("Error compiling macro library: %s\n", library_source);
+        result = 1;
+    }
+    if (library_path != NULL && result == 0)
+    {
+        library = open_macro_library(library_path);
+        default_options.macro_library = library;
+        if (library == NULL)
+        {
+            printf("Invalid macro library: %s\n", library_path);
+            result = 1;
+        }
+    }
 
-    if (argc < 2)
+    /* A library that failed, or a library without files to assemble, ends the run here.
+       No names were read from the manifests yet */
+    if (result != 0 || (library_source != NULL && file_count == 0 && manifest_count == 0))
+    {
+        free(files);
+        free(manifests);
+        close_macro_library(library);
+        return result;
+    }
+
+    if (server_socket != NULL)
+    {
+        result = run_server(server_socket);
+    }
+
+    else if (file_count == 0 && manifest_count == 0)
     {
         printf("Missing file as parameter\n");
-        return false;
+        result = false;
     }
 
-    for (i = 1; i < argc; i++)
+    /* These modes need the whole list before they start */
+    else if (watch || client_socket != NULL || program_name != NULL)
+    {
+        for (i = 0; i < manifest_count && result == 0; i++)
+        {
+            if (!read_whole_manifest(manifests[i], &files, &file_count, &file_capacity))
+            {
+                result = 1;
+            }
+        }
+
+        if (result == 0 && program_name != NULL)
+        {
+            result = link_program(program_name, files, file_count) ? 0 : 1;
+        }
+        else if (result == 0 && watch)
+        {
+            result = run_watch(files, file_count);
+        }
+        else if (result == 0)
+        {
+            result = run_client(client_socket, files, file_count);
+        }
+    }
+
+    /* A pipe in, a pipe out, and a status for the shell */
+    else if (file_count == 1 && manifest_count == 0 && strcmp(files[0], STDIO_FILE_NAME) == 0)
+    {
+        result = assemble_stdio() ? 0 : 1;
+    }
+    else if (pipelined)
+    {
+        assemble_in_pipeline(files, file_count, manifests, manifest_count);
+    }
+    else if (jobs > 1 && (file_count > 1 || manifest_count > 0))
+    {
+        /* Like the serial run, failed files are only reported */
+        assemble_in_parallel(files, file_count, manifests, manifest_count, jobs);
+    }
+    else
+    {
+        /* The threads aren't needed for other files, so one large file may use them */
+        default_options.preprocess_threads = jobs;
+        assemble_in_order(files, file_count, manifests, manifest_count);
+    }
+
+    /* Only the names read from manifests were allocated */
+    for (i = argv_file_count; i < file_count; i++)
+    {
+        free(files[i]);
+    }
+    free(files);
+    free(manifests);
+    close_macro_library(library);
+
+    return result;
+}
+
+/*
+* Assembles the command line files, then every manifest entry as soon as it is read.
+*/
+bool assemble_in_order(char **files, int file_count, char **manifests, int manifest_count)
+{
+    char entry[MAX_MANIFEST_LINE];
+    FILE *manifest;
+    bool all_success = true;
+    int i;
+
+    /* The first files are read ahead before the loop, then one more per file */
+    for (i = 0; i < file_count && i < PREFETCH_DEPTH; i++)
+    {
+        prefetch_source_file(files[i]);
+    }
+
+    for (i = 0; i < file_count; i++)
+    {
+        if (i + PREFETCH_DEPTH < file_count)
+        {
+            prefetch_source_file(files[i + PREFETCH_DEPTH]);
+        }
+
+        if (!process_file(files[i]))
+        {
+            printf("Error processing file: %s\n", files[i]);
+            all_success = false;
+        }
+    }
+
+    for (i = 0; i < manifest_count; i++)
     {
-        if (!process_file(argv[i]))
+        manifest = open_manifest(manifests[i]);
+        if (manifest == NULL)
+        {
+            continue;
+        }
+
+        while (next_manifest_entry(manifest, entry))
         {
-            printf("Error processing file: %s\n", argv[i]);
+            if (!process_file(entry))
+            {
+                printf("Error processing file: %s\n", entry);
+                all_success = false;
+            }
         }
+
+        close_manifest(manifest);
     }
 
-    return 0;
+    return all_success;
 }
 
+/*
+* Submits the command line files as one group (so they are scheduled by size),
+* then streams the manifest entries to the workers while the manifests are read,
+* printing the files that are already done along the way.
+*/
+bool assemble_in_parallel(char **files, int file_count, char **manifests, int manifest_count, int jobs)
+{
+    char entry[MAX_MANIFEST_LINE];
+    char *entry_name = entry;
+    FILE *manifest;
+    batch work;
+    int i;
+
+    /* A fixed list needs no more workers than files */
+    if (manifest_count == 0)
+    {
+        return run_batch(files, file_count, jobs);
+    }
+
+    start_batch(&work, jobs);
+
+    if (file_count > 0)
+    {
+        submit_jobs(&work, files, file_count);
+    }
+
+    for (i = 0; i < manifest_count; i++)
+    {
+        manifest = open_manifest(manifests[i]);
+        if (manifest == NULL)
+        {
+            continue;
+        }
+
+        while (next_manifest_entry(manifest, entry))
+        {
+            submit_jobs(&work, &entry_name, 1);
+            print_finished_jobs(&work, false);
+        }
+
+        close_manifest(manifest);
+    }
+
+    return finish_batch(&work);
+}
 
 /*
-* Handles the full assembly process for a given source file.
-* Performs preprocessing, first pass, second pass, translation, and cleanup.
+* Feeds the command line files, then the manifest entries as they are read, to the pipeline.
+* Submitting blocks while the first stage is behind, so the manifest is read at its pace.
 */
-bool process_file(char *filename)
+bool assemble_in_pipeline(char **files, int file_count, char **manifests, int manifest_count)
 {
-    assembler_table *assembler = NULL;
+    char entry[MAX_MANIFEST_LINE];
+    FILE *manifest;
+    pipeline line;
+    int i;
 
-    /* Check for filename length */
-    if (strlen(filename) > MAX_LABEL_LENGTH)
+    /* Without the stage threads, the files go through the stages one after the other */
+    if (!start_pipeline(&line))
     {
-        errors_table(FILE_NAME_EXCEED_MAXIMUM, -1);
-        return false;
+        return assemble_in_order(files, file_count, manifests, manifest_count);
     }
 
-    /* Initialize main assembler table */
-    assembler = initialize_assembler_table(filename);
-    if (!assembler)
+    for (i = 0; i < file_count; i++)
     {
-        printf("Failed to initialize assembler table\n");
-        return false;
+        submit_to_pipeline(&line, files[i]);
     }
 
-    /* Run preprocessor */
-    if (!pre_proc(&assembler))
+    for (i = 0; i < manifest_count; i++)
     {
-        free_assembler_table(assembler);
-        return false;
+        manifest = open_manifest(manifests[i]);
+        if (manifest == NULL)
+        {
+            continue;
+        }
+
+        while (next_manifest_entry(manifest, entry))
+        {
+            submit_to_pipeline(&line, entry);
+        }
+
+        close_manifest(manifest);
     }
 
-    /* Run first pass */
-    if (!first_pass(filename, assembler))
+    return finish_pipeline(&line);
+}
+
+/*
+* Assembles stdin to stdout. Nothing goes through the file system,
+* so the cache and the .am file don't apply.
+*/
+bool assemble_stdio(void)
+{
+    assembler_table *assembler;
+    bool success;
+
+    /* stdout carries the object image */
+    set_diagnostics_output(stderr);
+    default_options.use_stdio = true;
+
+    assembler = initialize_assembler_table("");
+    if (!assembler)
     {
-        first_pass_errors(ERR_FIRST_PASS, -1, -1);
-        free_assembler_table(assembler);
+        diagnostic_printf("Failed to initialize assembler table\n");
         return false;
     }
+    assembler->source_stream = stdin;
 
-    /* Run second pass */
-    if (!second_pass(&assembler))
+    success = run_assembly_stages(assembler, STDIO_FILE_NAME);
+    if (!success)
     {
-        free_assembler_table(assembler);
+        diagnostic_printf("Error processing file: %s\n", STDIO_FILE_NAME);
+    }
+
+    free_assembler_table(assembler);
+
+    return success;
+}
+
+/*
+* Handles the full assembly process for a given source file.
+* Performs preprocessing, first pass, second pass, translation, and cleanup.
+*/
+bool process_file(char *filename)
+{
+    assembler_table *assembler = NULL;
+    bool success;
+
+    /* Initialize main assembler table */
+    assembler = initialize_assembler_table("");
+    if (!assembler)
+    {
+        diagnostic_printf("Failed to initialize assembler table\n");
         return false;
     }
 
-    /* Generate final output files */
-    translation_unit(assembler);
+    success = process_file_in_table(assembler, filename);
 
     /* Free all allocated memory */
     free_assembler_table(assembler);
 
-    return true;
+    return success;
+}
+
+/*
+* Checks the file name, then assembles the file on an existing table,
+* or restores the result of an earlier run from the cache when it is enabled.
+*/
+bool process_file_in_table(assembler_table *assembler, char *filename)
+{
+    /* Check for filename length */
+    if (strlen(filename) > MAX_LABEL_LENGTH)
+    {
+        errors_table(FILE_NAME_EXCEED_MAXIMUM, -1);
+        return false;
+    }
+
+    if (cache_enabled())
+    {
+        return process_file_cached(assembler, filename);
+    }
+
+    return run_assembly_stages(assembler, filename);
 }
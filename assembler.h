@@ -5,6 +5,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include "diagnostics.h"
+
+/* Version of the assembler, part of every cache key.
+   Change it whenever the output or the messages for the same source change. */
+#define ASSEMBLER_VERSION "1.1"
 
 /* Maximum length of a line in source code file */
 #define MAX_LINE_LENGTH 81
@@ -12,6 +17,9 @@
 /* Maximum length of a label */
 #define MAX_LABEL_LENGTH 31
 
+/* File name that assembles stdin to stdout */
+#define STDIO_FILE_NAME "-"
+
 /* Internal constants for assembler usage */
 #define ENTRY 5
 #define R 2
@@ -50,7 +58,17 @@ typedef enum ERRORS
     FAILED_TO_REMOVE_FILE,       /* Failed to remove file */
     MALLOC_FAILED,               /* Memory allocation failed */
     ERROR_NOTE_WITH_SPACE,       /* A comment starting with ';', must appear only at the beginning of the line */
-    LINE_LENGTH_EXCEED_MAXIMUM   /* Line length too long */
+    LINE_LENGTH_EXCEED_MAXIMUM,  /* Line length too long */
+    TOO_MANY_ERRORS,             /* The file reached the --max-errors limit */
+    INCLUDE_INVALID_PATH,        /* .include without a file name in quotation marks */
+    INCLUDE_FAILED_TO_OPEN,      /* The included file can't be opened */
+    INCLUDE_RECURSIVE,           /* The included file is already being included */
+    INCLUDE_HAS_ERRORS,          /* The included file has errors */
+    INCLUDE_NOT_ALLOWED,         /* .include in a source assembled in memory */
+    MACRO_INVALID_PARAMETERS,    /* The parameters of a macro definition are invalid */
+    MACRO_WRONG_ARGUMENTS,       /* A macro call doesn't give one argument per parameter */
+    MACRO_LINE_TOO_LONG,         /* A line of a macro call is too long once the arguments are in */
+    FAILED_TO_WRITE_FILE         /* Failed to write a file */
 } ERRORS;
 
 /* Possible errors for the first pass */
@@ -89,21 +107,64 @@ typedef enum FIRST_PASS_ERRORS
 
 /*************************************************************************/
 
-/* Linked list node for storing macro content lines */
-typedef struct macro_content
+/* States of a compiled_line */
+#define LINE_NOT_COMPILED 0 /* The line wasn't expanded yet */
+#define LINE_COMPILED 1     /* The words of the line are kept, the next expansions copy them */
+#define LINE_NOT_REUSABLE 2 /* The line changes the labels or has errors, it's checked on every expansion */
+
+/* What one line of a macro body added to the first pass, kept after its first expansion */
+typedef struct compiled_line
 {
-    char content_line[MAX_LINE_LENGTH]; /* One line of macro content */
-    struct macro_content *next;         /* Pointer to next content line */
-} macro_content;
+    int state;                   /* LINE_NOT_COMPILED, LINE_COMPILED or LINE_NOT_REUSABLE */
+    struct command *words;       /* The code words, their address is relative to the IC before the line */
+    int word_count;              /* Number of code words */
+    int instruction_count;       /* How much the line advances the IC (with --check, more than word_count) */
+    struct data *data_words;     /* The data words */
+    int data_count;              /* Number of data words */
+} compiled_line;
+
+/* Most parameters a macro can have */
+#define MAX_MACRO_PARAMETERS 8
+
+/* Starts a reference to a parameter in the body of a macro: "%name" */
+#define MACRO_PARAMETER_SIGN '%'
+
+/* Where an argument goes in the body of a parameterized macro */
+typedef struct macro_slot
+{
+    long offset;    /* Offset of the "%name" in the body */
+    long length;    /* Its number of bytes, replaced by the argument */
+    long parameter; /* Index of the parameter */
+} macro_slot;
 
-/* Macro struct: macro name, linked list of content lines, pointer to next macro */
+/* Macro struct: macro name, its body, pointer to next macro.
+   The node and the body live in the macro arena of the file. */
 typedef struct macro
 {
     char macro_name[MAX_LINE_LENGTH]; /* Macro name */
-    struct macro_content *content;    /* List of content lines */
+    unsigned long hash;               /* Hash of the name (see hash_macro_name()) */
+    char *body;                       /* The lines of the macro one after the other, not null terminated */
+    long body_length;                 /* Number of bytes of the body */
+    int line_count;                   /* Number of lines of the body */
+    struct compiled_line *compiled;   /* One per line, NULL until the first pass meets the macro */
+    int defined_line;                 /* Source line of its "mcro", 0 if it comes from elsewhere */
+    int parameter_count;              /* Number of parameters, 0 for a macro called by its name alone */
+    struct macro_slot *slots;         /* Where the arguments go in the body, in order */
+    int slot_count;                   /* Number of slots */
     struct macro *next;               /* Next macro in list */
 } macro;
 
+/* Number of slots the macro index starts with (a power of two) */
+#define MACRO_INDEX_INITIAL_SIZE 64
+
+/* Open addressing hash table over the macros of the list, so finding a macro doesn't scan the list */
+typedef struct macro_index
+{
+    struct macro **slots; /* Linear probing slots, NULL when empty */
+    long capacity;        /* Number of slots (a power of two, 0 before the first macro) */
+    long count;           /* Number of macros in the slots */
+} macro_index;
+
 /* External usage struct: list of addresses where external label is used */
 typedef struct external_usage
 {
@@ -160,6 +221,102 @@ typedef struct data
     struct data *next; /* Next data element */
 } data;
 
+/* Growable text buffer, holds the macro expanded source between the preprocessor and the first pass */
+typedef struct text_buffer
+{
+    char *text;    /* The text (not null terminated) */
+    long length;   /* Number of bytes used */
+    long capacity; /* Number of bytes allocated */
+} text_buffer;
+
+/* The whole source of a file, mapped or read at once, with the start of every line */
+typedef struct source_reader
+{
+    const char *text;  /* The source (not null terminated) */
+    long length;       /* Number of bytes of the source */
+    long *line_starts; /* Offset of every line, then the length of the source */
+    long line_count;   /* Number of lines */
+    long line;         /* The line being read */
+    long position;     /* Offset of the next byte to read */
+    void *mapping;     /* The mapping of the file, NULL if the source was read into memory */
+} source_reader;
+
+/* Number of pieces of the .am file gathered for one writev() */
+#define AM_WRITE_BATCH 1024
+
+/* A piece of the .am file, kept until its batch is written */
+typedef struct am_piece
+{
+    const char *text; /* Text that stays put (a macro body), NULL for a part of the expanded source */
+    long offset;      /* For a part of the expanded source: its offset */
+    long length;      /* Number of bytes */
+} am_piece;
+
+/* Writes the .am file with writev(), from the macro bodies and the expanded source, without copying them */
+typedef struct am_writer
+{
+    int fd;                              /* The .am file */
+    const struct text_buffer *expanded;  /* The expanded source of the table, which the pieces may point into */
+    am_piece pieces[AM_WRITE_BATCH];     /* The pieces not written yet */
+    int count;                           /* Number of pieces */
+    int batch;                           /* Number of pieces written at once */
+    bool failed;                         /* Set once a write failed; nothing more is written */
+} am_writer;
+
+/* A macro call in the expanded source */
+typedef struct macro_expansion
+{
+    long first_line;      /* Line of the expanded source where the body starts */
+    struct macro *source; /* The expanded macro */
+} macro_expansion;
+
+/* Where the preprocessor expanded macros, for the first pass to reuse their compiled lines */
+typedef struct expansion_map
+{
+    macro_expansion *items; /* The calls, in the order of the expanded source */
+    long count;             /* Number of calls */
+    long capacity;          /* Number of calls allocated */
+    long lines;             /* Number of lines of the expanded source so far */
+} expansion_map;
+
+/* Size of a block of the macro arena, bigger bodies get a block of their own */
+#define ARENA_BLOCK_SIZE 16384
+
+/* Block of an arena, followed by its bytes */
+typedef struct arena_block
+{
+    struct arena_block *next; /* Block allocated before this one */
+    long size;                /* Number of bytes of the block */
+    long used;                /* Number of bytes handed out */
+} arena_block;
+
+/* Bump allocator: everything allocated from it is freed at once */
+typedef struct arena
+{
+    struct arena_block *blocks; /* The current block, then the older ones */
+} arena;
+
+/* A precompiled macro library (see macro_library.h) */
+struct macro_library;
+
+/* A file being included (see include_cache.h) */
+struct include_frame;
+
+/* Options that change how a file is assembled */
+typedef struct assembler_options
+{
+    bool keep_am;   /* Also write the macro expanded source to the .am file */
+    bool use_stdio; /* Write all the output to stdout, in tagged sections (the source comes from stdin) */
+    int max_errors; /* Stop a file after this many errors, 0 for no limit */
+    bool check_only; /* Only report the errors: no encoding and no output files */
+    int preprocess_threads; /* Threads that may expand one large source, 0 or 1 for a serial preprocessor */
+    const struct macro_library *macro_library; /* Macros every file starts with, NULL for none */
+    bool memory_only; /* Never touch the file system (the library): .include is an error */
+} assembler_options;
+
+/* The options given on the command line, used by every table unless it is given others */
+extern assembler_options default_options;
+
 /* Main assembler table struct holding all sections and metadata */
 typedef struct assembler_table
 {
@@ -168,11 +325,22 @@ typedef struct assembler_table
     struct label *label_list;                   /* Pointer to label list */
     struct external_label *external_list;       /* Pointer to external labels list */
     struct macro *macro_list;                   /* Pointer to macros list */
+    struct macro_index macros;                  /* Hash index over the macros list */
+    struct macro_index library_macros;          /* The macros of the library the file used so far */
+    struct arena macro_storage;                 /* Holds the macros and their bodies until the next file */
+    struct expansion_map expansions;            /* The macro calls of the expanded source */
     char source_file[MAX_LABEL_LENGTH];         /* Source file name */
     char macro_expanded_file[MAX_LABEL_LENGTH]; /* Macro expanded file name */
     char assembly_file[MAX_LABEL_LENGTH];       /* Output assembly file name */
     int instruction_counter;                    /* Instruction counter */
     int data_counter;                           /* Data counter */
+    int error_count;                            /* Errors reported for the current file */
+    struct text_buffer expanded_source;         /* Macro expanded source, read by the first pass */
+    const struct assembler_options *options;    /* Options of this run */
+    FILE *source_stream;                        /* Source to read instead of the .as file, NULL for the file */
+    const struct include_frame *includer;       /* The files that include this one, NULL for a source (see include_cache.h) */
+    struct source_reader *open_source;          /* The source pre_proc() is reading, NULL outside of it */
+    struct am_writer *open_am;                  /* The .am file pre_proc() is writing, NULL if none */
 } assembler_table;
 
 /**
@@ -185,6 +353,106 @@ typedef struct assembler_table
  */
 bool process_file(char *filename);
 
+/**
+ * Runs the full assembly process on a given file, using an existing assembler table.
+ * The table is reset before the file is processed and emptied afterwards,
+ * so a long running process can reuse the same table for many files.
+ *
+ * @param assembler The table to use.
+ * @param filename The name of the input file (without extension).
+ * @return true if the file was processed successfully, false if an error occurred.
+ */
+bool process_file_in_table(assembler_table *assembler, char *filename);
+
+/**
+ * Assembles the given files one after the other, then the entries of each manifest
+ * as soon as they are read. Failures are reported after the messages of each file.
+ *
+ * @param files The command line files (without extension).
+ * @param file_count Number of files.
+ * @param manifests Paths of the manifests to read.
+ * @param manifest_count Number of manifests.
+ * @return true if all the files were assembled successfully, false otherwise.
+ */
+bool assemble_in_order(char **files, int file_count, char **manifests, int manifest_count);
+
+/**
+ * Assembles the given files and the manifest entries with a pool of worker threads.
+ * Manifest entries are handed to the workers while the manifests are still being read.
+ * The messages are printed in the same order as assemble_in_order() would print them.
+ *
+ * @param files The command line files (without extension).
+ * @param file_count Number of files.
+ * @param manifests Paths of the manifests to read.
+ * @param manifest_count Number of manifests.
+ * @param jobs Number of worker threads.
+ * @return true if all the files were assembled successfully, false otherwise.
+ */
+bool assemble_in_parallel(char **files, int file_count, char **manifests, int manifest_count, int jobs);
+
+/**
+ * Assembles the command line files and the manifest entries with one thread per stage,
+ * so consecutive files are preprocessed, assembled and written at the same time.
+ * The messages are printed in the given order, like a serial run.
+ *
+ * @param files The command line files (without extension).
+ * @param file_count Number of files.
+ * @param manifests Paths of the manifests to read.
+ * @param manifest_count Number of manifests.
+ * @return true if all the files were assembled successfully, false otherwise.
+ */
+bool assemble_in_pipeline(char **files, int file_count, char **manifests, int manifest_count);
+
+/**
+ * Assembles the source read from stdin, and writes the object image, the entries
+ * and the externals to stdout as tagged sections. Diagnostics are printed to stderr.
+ *
+ * @return true if the source was assembled successfully, false otherwise.
+ */
+bool assemble_stdio(void);
+
+/**
+ * Runs preprocessing, both passes and the output of one file on an existing table,
+ * without checking the cache.
+ *
+ * @param assembler The table to use.
+ * @param filename The name of the input file (without extension).
+ * @return true if the file was processed successfully, false if an error occurred.
+ */
+bool run_assembly_stages(assembler_table *assembler, char *filename);
+
+/**
+ * First stage of the assembly: resets the table for the file and runs the preprocessor.
+ *
+ * @param assembler The table to use.
+ * @param filename The name of the input file (without extension).
+ * @return true if preprocessing succeeded.
+ */
+bool preprocess_stage(assembler_table *assembler, char *filename);
+
+/**
+ * Second stage of the assembly: runs the first and second pass on a preprocessed table.
+ *
+ * @param assembler The preprocessed table.
+ * @param filename The name of the input file (without extension).
+ * @return true if both passes succeeded.
+ */
+bool passes_stage(assembler_table *assembler, char *filename);
+
+/**
+ * Last stage of the assembly: writes the .ob, .ent and .ext files (nothing with --check).
+ *
+ * @param assembler A table that passed both passes.
+ */
+void output_stage(assembler_table *assembler);
+
+/**
+ * Prints a message when a stage failed because the file reached the --max-errors limit.
+ *
+ * @param assembler The table of the file.
+ */
+void report_error_limit(assembler_table *assembler);
+
 /**
  * Extracts a token from the line up to the given delimiter.
  * Copies the token into dest and returns the position after the delimiter.
@@ -196,14 +464,6 @@ bool process_file(char *filename);
  * @return Position after the delimiter or 0 if not found.
  */
 int my_tokenaizer(char dest[MAX_LINE_LENGTH], char *line, char delimeter);
-/**
- * Removes spaces and tabs from the input line until a comment (';') is reached.
- * The cleaned line is copied into dest.
- *
- * @param dest Buffer to store the cleaned line.
- * @param line The input line to process.
- */
-void remove_white_spaces(char dest[MAX_LINE_LENGTH], char *line);
 /**
  * Allocates memory of the given size and ensures it succeeded.
  * @param size The number of bytes to allocate.
@@ -226,37 +486,125 @@ FILE *my_fopen(char *name, char *mode);
 void add_ending_to_string(char *dest, const char *file_name, const char *ending);
 
 /**
- * Checks for invalid comment positioning in a line.
- * A comment (';') must appear only at the beginning of the line.
+ * Performs the preprocessing stage on the input file.
+ * Expands macros and handles errors. The expanded source is kept in the table
+ * for the first pass, and written to the .am file only if the options ask for it.
  *
- * @param line The input line to check.
- * @param line_counter The current line number (for error reporting).
- * @return false if the comment is in an invalid position, true otherwise.
+ * @param assembler Pointer to the assembler table.
+ * @return true if preprocessing succeeded, false if an error occurred.
  */
 
-
-bool handle_notes_error(char line[], int line_counter);
+bool pre_proc(assembler_table **assembler);
 
 /**
- * Performs the preprocessing stage on the input file.
- * Expands macros, handles errors, and creates the .am file.
+ * Releases the source and the .am file of a pre_proc() that a fatal error jumped out of,
+ * and deletes the partial .am file. Does nothing outside of pre_proc().
  *
- * @param assembler Pointer to the assembler table.
- * @return true if preprocessing succeeded, false if an error occurred.
+ * @param assembler The table of the file that was given up.
  */
+void abandon_pre_proc(assembler_table *assembler);
 
-bool pre_proc(assembler_table **assembler);
 /**
- * Initializes file pointers for assembly and macro-expanded files.
+ * Loads the source and opens the macro-expanded file.
  * Also prepares buffers for lines and macro names.
  *
  * @param assembler Pointer to the assembler table structure.
- * @param fp_as Pointer to assembly file pointer (to be opened).
- * @param fp_am Pointer to macro-expanded file pointer (to be opened).
+ * @param source The reader to load the .as file (or the table's source_stream) into.
+ * @param am Receives the writer of the .am file (opened only with keep_am and without check_only, NULL otherwise).
  * @param line Buffer for reading lines.
  * @param macro_name Buffer for storing macro names.
  */
-void files_initialize(assembler_table **assembler, FILE **fp_as, FILE **fp_am, char line[MAX_LINE_LENGTH], char macro_name[MAX_LINE_LENGTH]);
+void files_initialize(assembler_table **assembler, source_reader *source, am_writer **am, char line[MAX_LINE_LENGTH], char macro_name[MAX_LINE_LENGTH]);
+
+/* ============================ Source reader ================================== */
+
+/**
+ * Loads a whole source: a regular file is mapped into memory (unless mapping is
+ * turned off, see set_source_mapping()), any other stream is read at once.
+ * Then the start of every line is found in one scan of the text.
+ *
+ * @param source The reader.
+ * @param fp The open source. The reader doesn't use it once this returns.
+ */
+void open_source_reader(source_reader *source, FILE *fp);
+
+/**
+ * Chooses whether open_source_reader() maps regular files. A mapped file that is
+ * truncated while it is read (an editor saving it) kills the process with SIGBUS,
+ * so the long running modes (--server, --watch) read every file at once instead.
+ *
+ * @param enabled false to read the files into memory.
+ */
+void set_source_mapping(bool enabled);
+
+/**
+ * Reads the next line of the source into 'line', like fgets() does with a file:
+ * stops after a '\n' or when MAX_LINE_LENGTH - 1 characters were copied.
+ *
+ * @param source The reader.
+ * @param line Receives the line, null terminated (empty at the end of the source).
+ * @return true if a line was read, false at the end of the source.
+ */
+bool read_source_line(source_reader *source, char line[MAX_LINE_LENGTH]);
+
+/**
+ * Skips what is left of the current line, after a line that was too long.
+ *
+ * @param source The reader.
+ */
+void skip_source_line(source_reader *source);
+
+/**
+ * Unmaps or frees the source and its line index.
+ *
+ * @param source The reader.
+ */
+void close_source_reader(source_reader *source);
+
+/* ============================ .am writer ================================== */
+
+/**
+ * Creates the .am file. Exits (or gives up the file, in the library) if it can't be created.
+ *
+ * @param path The path of the .am file.
+ * @param expanded The expanded source of the table, which pieces given by offset are in.
+ * @return The writer.
+ */
+am_writer *open_am_writer(const char *path, const text_buffer *expanded);
+
+/**
+ * Adds a piece to the .am file. It is written with the next batch,
+ * so text given by address must stay put until then.
+ *
+ * @param am The writer.
+ * @param text Text that stays put (a macro body), or NULL for a part of the expanded source.
+ * @param offset For a part of the expanded source: its offset.
+ * @param length Number of bytes.
+ */
+void add_am_piece(am_writer *am, const char *text, long offset, long length);
+
+/**
+ * Writes the pieces gathered so far with writev().
+ *
+ * @param am The writer.
+ */
+void flush_am_writer(am_writer *am);
+
+/**
+ * Writes the last pieces and closes the .am file.
+ * Reports FAILED_TO_WRITE_FILE if a write failed.
+ *
+ * @param am The writer.
+ * @return true if the whole file was written.
+ */
+bool close_am_writer(am_writer *am);
+
+/**
+ * Closes the .am file without writing the pieces left, for a file that was given up.
+ *
+ * @param am The writer.
+ */
+void discard_am_writer(am_writer *am);
 /**
  * Shifts a 16-bit word to the left by a given number of bits.
  * @param word The word to be shifted.
@@ -273,6 +621,40 @@ unsigned short move_bits(unsigned short word, unsigned short move);
  */
 assembler_table *initialize_assembler_table(char *argv);
 
+/**
+ * Frees all the lists held by an assembler_table and sets it up for a new source file,
+ * without freeing the table itself.
+ * @param table - the table to reset.
+ * @param argv - source file name string.
+ */
+void reset_assembler_table(assembler_table *table, char *argv);
+
+/**
+ * Appends text to the end of a text buffer, doubling its size when it is full.
+ * @param buffer - the buffer to append to.
+ * @param text - the text to append.
+ * @param length - number of bytes to append.
+ */
+void append_to_text_buffer(text_buffer *buffer, const char *text, long length);
+
+/**
+ * Reads the next line of a text buffer, the same way fgets() reads a file:
+ * up to MAX_LINE_LENGTH - 1 characters, including the '\n'.
+ * @param buffer - the buffer to read from.
+ * @param position - pointer to the read position, advanced past the line.
+ * @param line - output buffer.
+ * @return true if a line was read, false at the end of the buffer.
+ */
+bool read_text_buffer_line(text_buffer *buffer, long *position, char line[MAX_LINE_LENGTH]);
+
+/**
+ * Records a macro call at the current end of the expanded source,
+ * and counts the lines of its body as lines of the expanded source.
+ * @param map - the expansion map of the table.
+ * @param source - the expanded macro.
+ */
+void add_macro_expansion(expansion_map *map, macro *source);
+
 /**
  * Add a new usage address to the external usage linked list.
  * Creates a new external_usage node for the given address.
@@ -315,6 +697,15 @@ void translation_unit(assembler_table *assembler);
  */
 void errors_table(ERRORS error_code, int line_counter);
 
+/**
+ * Checks if the current file reached the --max-errors limit,
+ * in which case the stages stop scanning it.
+ *
+ * @param table The assembler table of the file.
+ * @return true if the limit is set and reached.
+ */
+bool error_limit_reached(const assembler_table *table);
+
 /**
  * Prints an error message based on an error code and optional line number of the first pass.
  * @param error_code The type of error.
@@ -361,17 +752,67 @@ void free_external_usage_list(external_usage *head);
  */
 void free_external_list(external_label *head);
 /**
- * Frees a linked list of macro content lines.
+ * Allocates memory from an arena. The memory is aligned for any of the assembler's structs.
+ *
+ * @param storage Pointer to the arena.
+ * @param size Number of bytes.
+ * @return Pointer to the memory, valid until the arena is reset.
+ */
+void *arena_alloc(arena *storage, long size);
+/**
+ * Frees everything allocated from an arena, keeping its first block for the next file.
+ *
+ * @param storage Pointer to the arena.
+ */
+void reset_arena(arena *storage);
+/**
+ * Frees every block of an arena.
+ *
+ * @param storage Pointer to the arena.
+ */
+void free_arena(arena *storage);
+/**
+ * Hashes a macro name, up to a '\n', the '(' of the arguments of a call, or the end of the string.
+ *
+ * @param name The name, or a line that may be a macro call.
+ * @param length Receives the length of the name.
+ * @return The hash of the name.
+ */
+unsigned long hash_macro_name(const char *name, size_t *length);
+/**
+ * Counts the lines of a macro body the way read_text_buffer_line() splits them:
+ * after a '\n', or after MAX_LINE_LENGTH - 1 characters.
+ *
+ * @param body The body, not null terminated.
+ * @param length Number of bytes of the body.
+ * @return The number of lines.
+ */
+int count_body_lines(const char *body, long length);
+/**
+ * Adds a macro to the hash index, growing the index when it is half full.
+ *
+ * @param index The macro index.
+ * @param new_macro The macro, with its hash set.
+ */
+void add_to_macro_index(macro_index *index, macro *new_macro);
+/**
+ * Empties a macro index, keeping its slots for the next file.
+ *
+ * @param index Pointer to the index.
+ */
+void clear_macro_index(macro_index *index);
+/**
+ * Frees the slots of a macro index and empties it.
  *
- * @param head Pointer to the head of the macro content list.
+ * @param index Pointer to the index.
  */
-void free_macro_content_list(macro_content *head);
+void free_macro_index(macro_index *index);
 /**
- * Frees a linked list of macro nodes, including their content lines.
+ * Frees the text of a text buffer and empties it.
  *
- * @param head Pointer to the head of the macro list.
+ * @param buffer Pointer to the buffer.
  */
-void free_macro_list(macro *head);
+void free_text_buffer(text_buffer *buffer);
 /**
  * Frees all memory used by the assembler table and its internal components.
  *
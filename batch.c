@@ -0,0 +1,520 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "batch.h"
+
+/*
+ * Orders jobs by descending file size, keeping the given order on ties.
+ */
+static int compare_job_size(const void *a, const void *b)
+{
+    const batch_job *first = *(batch_job *const *)a, *second = *(batch_job *const *)b;
+
+    if (first->size != second->size)
+    {
+        return first->size < second->size ? 1 : -1;
+    }
+    return first < second ? -1 : (first > second);
+}
+
+/*
+ * Returns the size of "<filename>.as", or 0 if it doesn't exist.
+ */
+long source_file_size(const char *filename)
+{
+    char path[MAX_LINE_LENGTH];
+    struct stat info;
+
+    /* Too long names are reported by process_file() */
+    if (strlen(filename) > MAX_LABEL_LENGTH)
+    {
+        return 0;
+    }
+
+    add_ending_to_string(path, filename, ".as");
+    if (stat(path, &info) != 0)
+    {
+        return 0;
+    }
+
+    return (long)info.st_size;
+}
+
+/*
+ * posix_fadvise() only schedules the reads, the data arrives while the caller goes on.
+ */
+void prefetch_source_file(const char *filename)
+{
+    char path[MAX_LINE_LENGTH];
+    int fd;
+
+    /* Too long names are reported by process_file() */
+    if (strlen(filename) > MAX_LABEL_LENGTH)
+    {
+        return;
+    }
+
+    add_ending_to_string(path, filename, ".as");
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+/*
+ * The names are copied under the lock: once unlocked, another worker may take,
+ * finish and free those jobs.
+ */
+void prefetch_queued_jobs(worker_queue *queue)
+{
+    char names[PREFETCH_DEPTH][MAX_LABEL_LENGTH + 1];
+    batch_job *job;
+    int i, count = 0;
+
+    pthread_mutex_lock(&queue->lock);
+    for (job = queue->head, i = 0; job != NULL && i < PREFETCH_DEPTH; job = job->next_in_queue, i++)
+    {
+        if (!job->prefetched && strlen(job->filename) <= MAX_LABEL_LENGTH)
+        {
+            job->prefetched = true;
+            strcpy(names[count++], job->filename);
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    for (i = 0; i < count; i++)
+    {
+        prefetch_source_file(names[i]);
+    }
+}
+
+/*
+ * Inserts the job before the first smaller one, so the head is always the largest.
+ */
+void insert_job(worker_queue *queue, batch_job *job)
+{
+    batch_job **position;
+
+    pthread_mutex_lock(&queue->lock);
+
+    position = &queue->head;
+    while (*position != NULL && (*position)->size >= job->size)
+    {
+        position = &(*position)->next_in_queue;
+    }
+
+    job->next_in_queue = *position;
+    *position = job;
+    queue->queued_bytes += job->size;
+
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Pops the head of the queue, which is the largest job left in it.
+ */
+batch_job *take_job(worker_queue *queue)
+{
+    batch_job *job;
+
+    pthread_mutex_lock(&queue->lock);
+    job = queue->head;
+    if (job != NULL)
+    {
+        queue->head = job->next_in_queue;
+        queue->queued_bytes -= job->size;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return job;
+}
+
+/*
+ * Finds the queue with the most bytes still waiting and takes its head.
+ * Another worker may empty the victim before we lock it again, so take_job()
+ * rechecks it, and the search repeats until all the queues are empty.
+ */
+batch_job *steal_job(batch *work)
+{
+    worker_queue *victim;
+    batch_job *job;
+    int i;
+
+    while (true)
+    {
+        victim = NULL;
+
+        for (i = 0; i < work->queue_count; i++)
+        {
+            worker_queue *queue = &work->queues[i];
+
+            pthread_mutex_lock(&queue->lock);
+            if (queue->head != NULL &&
+                (victim == NULL || queue->queued_bytes > victim->queued_bytes))
+            {
+                victim = queue;
+            }
+            pthread_mutex_unlock(&queue->lock);
+        }
+
+        if (victim == NULL)
+        {
+            return NULL;
+        }
+
+        job = take_job(victim);
+        if (job != NULL)
+        {
+            return job;
+        }
+    }
+}
+
+/*
+ * Assembles one file and collects everything it printed.
+ * The failure line is part of the block, like in the serial run.
+ */
+void run_job(batch_job *job)
+{
+    bool buffered = begin_buffered_diagnostics(&job->diagnostics);
+
+    job->success = process_file(job->filename);
+
+    if (!job->success)
+    {
+        diagnostic_printf("Error processing file: %s\n", job->filename);
+    }
+
+    if (buffered)
+    {
+        end_buffered_diagnostics(&job->diagnostics);
+    }
+}
+
+/*
+ * Runs the jobs of the worker's own queue, then steals from the others,
+ * and sleeps while there is nothing to do but more files may still come.
+ */
+void *batch_worker(void *arg)
+{
+    worker_queue *own = arg;
+    batch *work = own->work;
+    batch_job *job = NULL;
+    bool finished = false, has_token;
+    char token;
+
+    while (!finished)
+    {
+        /* Under make, every worker but the first runs its files on a jobserver token */
+        has_token = own->needs_token && acquire_job_token(work, &token);
+
+        if (!own->needs_token || has_token)
+        {
+            /* Own queue first, then help the busiest worker */
+            job = take_job(own);
+            if (job == NULL)
+            {
+                job = steal_job(work);
+            }
+        }
+
+        if (job == NULL && has_token)
+        {
+            release_jobserver_token(&work->tokens, token);
+        }
+
+        if (job != NULL)
+        {
+            /* The next files of the queue are read while this one is assembled */
+            prefetch_queued_jobs(own);
+
+            pthread_mutex_lock(&work->lock);
+            work->pending--;
+            pthread_mutex_unlock(&work->lock);
+
+            run_job(job);
+
+            if (has_token)
+            {
+                release_jobserver_token(&work->tokens, token);
+            }
+
+            /* Let the printing thread know the file is done */
+            pthread_mutex_lock(&work->lock);
+            job->done = true;
+            pthread_cond_broadcast(&work->job_finished);
+            pthread_mutex_unlock(&work->lock);
+            job = NULL;
+            continue;
+        }
+
+        /* Nothing queued: wait for new files, or stop once the input is closed */
+        pthread_mutex_lock(&work->lock);
+        while (work->pending == 0 && !work->input_closed)
+        {
+            pthread_cond_wait(&work->job_submitted, &work->lock);
+        }
+        finished = work->pending == 0 && work->input_closed;
+        pthread_mutex_unlock(&work->lock);
+    }
+
+    return NULL;
+}
+
+/*
+ * Polls the jobserver, giving up once every file has been taken by a worker,
+ * so an idle worker never sits on a token (or blocks the end of the batch).
+ */
+bool acquire_job_token(batch *work, char *token)
+{
+    bool waiting = true;
+
+    while (waiting)
+    {
+        if (take_jobserver_token(&work->tokens, token, JOBSERVER_POLL_MS))
+        {
+            return true;
+        }
+
+        pthread_mutex_lock(&work->lock);
+        waiting = work->pending > 0;
+        pthread_mutex_unlock(&work->lock);
+    }
+
+    return false;
+}
+
+/*
+ * Writes the messages of a finished job to stdout, and frees the job.
+ */
+void print_job_diagnostics(batch_job *job)
+{
+    if (job->diagnostics.text != NULL)
+    {
+        fwrite(job->diagnostics.text, 1, job->diagnostics.size, stdout);
+        free(job->diagnostics.text);
+    }
+    fflush(stdout);
+
+    free(job->filename);
+    free(job);
+}
+
+/*
+ * Sets up the queues and starts one thread per queue.
+ */
+void start_batch(batch *work, int workers)
+{
+    int i;
+
+    /* Without a safe way to take tokens, only the job make gave the assembler runs */
+    connect_jobserver(&work->tokens);
+    if (work->tokens.single_job)
+    {
+        workers = 1;
+    }
+
+    work->job_capacity = 16;
+    work->jobs = my_malloc(sizeof(batch_job *) * work->job_capacity);
+    work->job_count = 0;
+    work->printed = 0;
+    work->pending = 0;
+    work->input_closed = false;
+    work->all_success = true;
+    work->queues = my_malloc(sizeof(worker_queue) * workers);
+    work->queue_count = workers;
+    pthread_mutex_init(&work->lock, NULL);
+    pthread_cond_init(&work->job_finished, NULL);
+    pthread_cond_init(&work->job_submitted, NULL);
+
+    for (i = 0; i < workers; i++)
+    {
+        work->queues[i].work = work;
+        work->queues[i].head = NULL;
+        work->queues[i].queued_bytes = 0;
+        work->queues[i].needs_token = work->tokens.active && i > 0;
+        pthread_mutex_init(&work->queues[i].lock, NULL);
+    }
+
+    work->threads = my_malloc(sizeof(pthread_t) * workers);
+    work->started = 0;
+    for (i = 0; i < workers; i++)
+    {
+        if (pthread_create(&work->threads[work->started], NULL, batch_worker, &work->queues[i]) == 0)
+        {
+            work->started++;
+        }
+    }
+}
+
+/*
+ * Appends the files to the print order, then places them largest first,
+ * each one on the queue that has the least work queued at that moment.
+ */
+void submit_jobs(batch *work, char **files, int file_count)
+{
+    batch_job **order = my_malloc(sizeof(batch_job *) * file_count);
+    batch_job **grown;
+    worker_queue *target;
+    int i, j;
+
+    for (i = 0; i < file_count; i++)
+    {
+        order[i] = my_malloc(sizeof(batch_job));
+        order[i]->filename = my_malloc(strlen(files[i]) + 1);
+        strcpy(order[i]->filename, files[i]);
+        order[i]->size = source_file_size(files[i]);
+        order[i]->success = false;
+        order[i]->done = false;
+        order[i]->prefetched = false;
+        order[i]->diagnostics.stream = NULL;
+        order[i]->diagnostics.text = NULL;
+        order[i]->diagnostics.size = 0;
+        order[i]->next_in_queue = NULL;
+    }
+
+    pthread_mutex_lock(&work->lock);
+
+    /* The print order is the submission order */
+    if (work->job_count + file_count > work->job_capacity)
+    {
+        while (work->job_count + file_count > work->job_capacity)
+        {
+            work->job_capacity *= 2;
+        }
+        grown = my_malloc(sizeof(batch_job *) * work->job_capacity);
+        memcpy(grown, work->jobs, sizeof(batch_job *) * work->job_count);
+        free(work->jobs);
+        work->jobs = grown;
+    }
+    for (i = 0; i < file_count; i++)
+    {
+        work->jobs[work->job_count++] = order[i];
+    }
+
+    /* Largest first, to the least loaded queue */
+    qsort(order, file_count, sizeof(batch_job *), compare_job_size);
+    for (i = 0; i < file_count; i++)
+    {
+        target = &work->queues[0];
+        for (j = 1; j < work->queue_count; j++)
+        {
+            pthread_mutex_lock(&work->queues[j].lock);
+            if (work->queues[j].queued_bytes < target->queued_bytes)
+            {
+                target = &work->queues[j];
+            }
+            pthread_mutex_unlock(&work->queues[j].lock);
+        }
+        insert_job(target, order[i]);
+    }
+
+    work->pending += file_count;
+    pthread_cond_broadcast(&work->job_submitted);
+    pthread_mutex_unlock(&work->lock);
+
+    free(order);
+}
+
+/*
+ * Prints the finished jobs at the front of the submission order.
+ */
+void print_finished_jobs(batch *work, bool wait)
+{
+    batch_job *job;
+
+    pthread_mutex_lock(&work->lock);
+    while (work->printed < work->job_count || (wait && !work->input_closed))
+    {
+        job = work->printed < work->job_count ? work->jobs[work->printed] : NULL;
+
+        if (job == NULL || !job->done)
+        {
+            if (!wait)
+            {
+                break;
+            }
+            pthread_cond_wait(&work->job_finished, &work->lock);
+            continue;
+        }
+
+        work->printed++;
+        if (!job->success)
+        {
+            work->all_success = false;
+        }
+
+        /* Printing doesn't need the lock, the job is no longer shared */
+        pthread_mutex_unlock(&work->lock);
+        print_job_diagnostics(job);
+        pthread_mutex_lock(&work->lock);
+    }
+    pthread_mutex_unlock(&work->lock);
+}
+
+/*
+ * Closes the input, prints everything that is left, and releases the batch.
+ */
+bool finish_batch(batch *work)
+{
+    int i;
+
+    pthread_mutex_lock(&work->lock);
+    work->input_closed = true;
+    pthread_cond_broadcast(&work->job_submitted);
+    pthread_mutex_unlock(&work->lock);
+
+    /* If no thread could be started, the main thread does all the work (stealing the other queues) */
+    if (work->started == 0)
+    {
+        batch_worker(&work->queues[0]);
+    }
+
+    print_finished_jobs(work, true);
+
+    for (i = 0; i < work->started; i++)
+    {
+        pthread_join(work->threads[i], NULL);
+    }
+
+    for (i = 0; i < work->queue_count; i++)
+    {
+        pthread_mutex_destroy(&work->queues[i].lock);
+    }
+
+    disconnect_jobserver(&work->tokens);
+    pthread_cond_destroy(&work->job_submitted);
+    pthread_cond_destroy(&work->job_finished);
+    pthread_mutex_destroy(&work->lock);
+    free(work->queues);
+    free(work->threads);
+    free(work->jobs);
+
+    return work->all_success;
+}
+
+/*
+ * Assembles a fixed list of files: submits them all at once, so they are
+ * scheduled by size, then prints them in the given order.
+ */
+bool run_batch(char **files, int file_count, int workers)
+{
+    batch work;
+
+    if (workers > file_count)
+    {
+        workers = file_count;
+    }
+
+    start_batch(&work, workers);
+    submit_jobs(&work, files, file_count);
+
+    return finish_batch(&work);
+}
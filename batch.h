@@ -0,0 +1,187 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <pthread.h>
+#include "assembler.h"
+#include "jobserver.h"
+
+/* ============================ Parallel batch assembly ================================== */
+
+/* Number of queued files whose sources are read ahead while a worker is busy */
+#define PREFETCH_DEPTH 4
+
+/* One input file of a batch, with the messages it produced */
+typedef struct batch_job
+{
+    char *filename;                 /* Copy of the file name (without extension) */
+    long size;                      /* Size of the .as file, used to schedule big files first */
+    bool success;                   /* Result of process_file() */
+    bool done;                      /* Set when a worker finished the file */
+    bool prefetched;                /* Set when the read ahead of its source was requested */
+    diagnostics_buffer diagnostics; /* Messages printed while assembling the file */
+    struct batch_job *next_in_queue; /* Next job in the same worker queue */
+} batch_job;
+
+struct batch;
+
+/* Queue of the files given to one worker, largest first */
+typedef struct worker_queue
+{
+    struct batch *work;   /* The batch the worker belongs to */
+    batch_job *head;      /* The next (largest) queued job */
+    long queued_bytes;    /* Total size of the files still queued */
+    bool needs_token;     /* Runs files only with a jobserver token (every worker but the first) */
+    pthread_mutex_t lock; /* Protects the queue against stealing workers */
+} worker_queue;
+
+/* Shared state of the worker pool */
+typedef struct batch
+{
+    batch_job **jobs;               /* The files in the order they were submitted (and are printed) */
+    int job_count;                  /* Number of submitted files */
+    int job_capacity;               /* Allocated size of the jobs array */
+    int printed;                    /* Number of jobs whose messages were printed */
+    int pending;                    /* Jobs submitted but not taken by a worker yet */
+    bool input_closed;              /* Set when no more files will be submitted */
+    bool all_success;               /* false once a printed job failed */
+    worker_queue *queues;           /* One queue per worker */
+    int queue_count;                /* Number of workers */
+    pthread_t *threads;             /* The worker threads */
+    int started;                    /* Number of threads that were started */
+    pthread_mutex_t lock;           /* Protects the jobs array, the counters and the done flags */
+    pthread_cond_t job_finished;    /* Signaled every time a file is done */
+    pthread_cond_t job_submitted;   /* Signaled when files are submitted or the input is closed */
+    jobserver tokens;               /* The jobserver of the parent make, if any */
+} batch;
+
+/**
+ * Assembles the given files with a pool of worker threads.
+ * The messages of every file are collected while it is assembled,
+ * and printed as one block, in the order the files were given.
+ *
+ * @param files Array of file names (without extension).
+ * @param file_count Number of files.
+ * @param workers Number of worker threads.
+ * @return true if all the files were assembled successfully, false otherwise.
+ */
+bool run_batch(char **files, int file_count, int workers);
+
+/**
+ * Starts the worker threads of an empty batch. Files are then given with submit_jobs(),
+ * and finish_batch() waits for all of them.
+ *
+ * @param work The batch to set up.
+ * @param workers Number of worker threads.
+ */
+void start_batch(batch *work, int workers);
+
+/**
+ * Adds files to a running batch. The files are printed in the given order,
+ * but scheduled largest first, each on the worker queue with the least work.
+ * Workers may already be assembling them when the function returns.
+ *
+ * @param work The running batch.
+ * @param files The file names (copied).
+ * @param file_count Number of files.
+ */
+void submit_jobs(batch *work, char **files, int file_count);
+
+/**
+ * Prints the messages of the jobs that are done, in submission order,
+ * stopping at the first job that is still running.
+ *
+ * @param work The batch.
+ * @param wait true to wait until every submitted job was printed and the input is closed.
+ */
+void print_finished_jobs(batch *work, bool wait);
+
+/**
+ * Closes the input of the batch, prints the remaining jobs, and stops the workers.
+ *
+ * @param work The batch.
+ * @return true if all the files were assembled successfully, false otherwise.
+ */
+bool finish_batch(batch *work);
+
+/**
+ * Thread function of a worker: takes files from its own queue, and when it is empty
+ * steals from the queue with the most work left. Waits for more files while the input
+ * is open, and ends when it is closed and every queue is empty.
+ *
+ * @param arg Pointer to the worker's queue.
+ * @return Always NULL.
+ */
+void *batch_worker(void *arg);
+
+/**
+ * Waits for a jobserver token, as long as there are files waiting for a worker.
+ *
+ * @param work The batch.
+ * @param token Receives the token.
+ * @return true if a token was taken, false if no file is waiting anymore.
+ */
+bool acquire_job_token(batch *work, char *token);
+
+/**
+ * Assembles one file of the batch, collecting its messages in the job.
+ *
+ * @param job The job to run.
+ */
+void run_job(batch_job *job);
+
+/**
+ * Prints the collected messages of a job and frees the job.
+ *
+ * @param job The finished job.
+ */
+void print_job_diagnostics(batch_job *job);
+
+/**
+ * Returns the size of the .as file of the given source, or 0 if it can't be read.
+ *
+ * @param filename The file name (without extension).
+ * @return The size in bytes.
+ */
+long source_file_size(const char *filename);
+
+/**
+ * Asks the kernel to start reading the .as file of a source into the page cache,
+ * so it is already there when the file is opened. Returns at once.
+ *
+ * @param filename The file name (without extension).
+ */
+void prefetch_source_file(const char *filename);
+
+/**
+ * Requests the read ahead of the next few files of a queue, which the worker
+ * will run after its current file.
+ *
+ * @param queue The worker's own queue.
+ */
+void prefetch_queued_jobs(worker_queue *queue);
+
+/**
+ * Inserts a job into a queue, keeping the queue sorted largest first.
+ *
+ * @param queue The queue.
+ * @param job The job to insert.
+ */
+void insert_job(worker_queue *queue, batch_job *job);
+
+/**
+ * Takes the next job from the head of a queue (the largest one left in it).
+ *
+ * @param queue The queue to take from.
+ * @return The job, or NULL if the queue is empty.
+ */
+batch_job *take_job(worker_queue *queue);
+
+/**
+ * Takes a job from the queue of the worker that has the most work left.
+ *
+ * @param work The batch.
+ * @return The job, or NULL if all the queues are empty.
+ */
+batch_job *steal_job(batch *work);
+
+#endif /* BATCH_H */
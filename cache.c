@@ -0,0 +1,433 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "macro_library.h"
+#include "pre_proc.h"
+
+/* The output files, in the order they are stored */
+static const char *output_endings[OUTPUT_ENDINGS] = {".am", ".ob", ".ent", ".ext"};
+
+/* The cache directory, set once by main() before any file is processed */
+static char cache_directory[MAX_CACHE_PATH];
+
+/*
+ * Enables the cache in the given directory.
+ */
+void set_cache_directory(const char *directory)
+{
+    strncpy(cache_directory, directory, sizeof(cache_directory) - 1);
+    cache_directory[sizeof(cache_directory) - 1] = '\0';
+
+    /* An existing directory is fine, any other failure shows up as cache misses */
+    mkdir(cache_directory, 0777);
+}
+
+/*
+ * Returns true if the cache was enabled.
+ */
+bool cache_enabled(void)
+{
+    return cache_directory[0] != '\0';
+}
+
+/*
+ * Builds the path of a cache entry.
+ */
+static void entry_path(char *dest, const char *key)
+{
+    sprintf(dest, "%s/%s", cache_directory, key);
+}
+
+/*
+ * Goes on with both hashes over the given bytes.
+ */
+static void hash_bytes(const unsigned char *bytes, size_t length, unsigned long *fnv, unsigned long *djb)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        *fnv = ((*fnv ^ bytes[i]) * 16777619UL) & 0xFFFFFFFFUL;
+        *djb = ((*djb << 5) + *djb + bytes[i]) & 0xFFFFFFFFUL;
+    }
+}
+
+static bool hash_source_file(const char *path, int depth, unsigned long *fnv, unsigned long *djb, unsigned long *size);
+
+/*
+ * Hashes the path and the contents of the file named by the rest of a directive line.
+ * A directive without a valid path names no file, and is only an error of the source.
+ */
+static bool hash_included_file(const char *text, int depth, unsigned long *fnv, unsigned long *djb, unsigned long *size)
+{
+    char included[MAX_LINE_LENGTH];
+
+    if (!extract_include_path(included, text))
+    {
+        return true;
+    }
+
+    hash_bytes((const unsigned char *)included, strlen(included) + 1, fnv, djb);
+    return hash_source_file(included, depth + 1, fnv, djb, size);
+}
+
+/*
+ * Hashes the contents of a file, then the path and the contents of every file
+ * it includes, at the end of the line of its directive. A directive is found
+ * like the preprocessor finds it: the line starts with ".include" once the spaces
+ * and tabs are removed. The paths count, since messages of included files start with them.
+ */
+static bool hash_source_file(const char *path, int depth, unsigned long *fnv, unsigned long *djb, unsigned long *size)
+{
+    const char *directive = ".include";
+    char text[MAX_LINE_LENGTH];
+    unsigned char chunk[4096];
+    size_t read, i, matched = 0, length = 0;
+    bool line_start = true, hashed = true;
+    FILE *fp;
+
+    if (depth > CACHE_INCLUDE_DEPTH || (fp = fopen(path, "rb")) == NULL)
+    {
+        return false;
+    }
+
+    while (hashed && (read = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    {
+        hash_bytes(chunk, read, fnv, djb);
+        *size += read;
+
+        for (i = 0; i < read && hashed; i++)
+        {
+            if (chunk[i] == '\n')
+            {
+                /* The end of a directive line: the file it names goes in here */
+                if (line_start && matched == strlen(directive))
+                {
+                    text[length] = '\0';
+                    hashed = hash_included_file(text, depth, fnv, djb, size);
+                }
+                line_start = true;
+                matched = length = 0;
+            }
+            else if (!line_start || chunk[i] == ' ' || chunk[i] == '\t')
+            {
+                continue;
+            }
+            else if (matched < strlen(directive))
+            {
+                line_start = chunk[i] == (unsigned char)directive[matched];
+                matched++;
+            }
+            else if (length < sizeof(text) - 1)
+            {
+                text[length++] = chunk[i];
+            }
+        }
+    }
+
+    /* The last line may have no '\n' */
+    if (hashed && line_start && matched == strlen(directive))
+    {
+        text[length] = '\0';
+        hashed = hash_included_file(text, depth, fnv, djb, size);
+    }
+
+    fclose(fp);
+    return hashed;
+}
+
+/*
+ * Hashes the version, the options and the contents of the .as file, with the files
+ * it includes, with two independent 32 bit hashes (FNV-1a and djb2), and adds the size,
+ * so an accidental collision is practically impossible.
+ */
+bool compute_cache_key(const char *filename, const assembler_options *options, char key[CACHE_KEY_LENGTH])
+{
+    char path[MAX_LINE_LENGTH];
+    char version[MAX_LINE_LENGTH];
+    unsigned long fnv = 2166136261UL, djb = 5381UL, size = 0;
+
+    add_ending_to_string(path, filename, ".as");
+
+    /* The version, the options that change the outputs and the macro library go first,
+       so a new assembler, a different mode or a rebuilt library never replays old results */
+    sprintf(version, "%s keep_am=%d max_errors=%d check_only=%d", ASSEMBLER_VERSION,
+            options->keep_am, options->max_errors, options->check_only);
+    if (options->macro_library != NULL)
+    {
+        sprintf(version + strlen(version), " macros=%08lx", options->macro_library->header->checksum);
+    }
+    hash_bytes((const unsigned char *)version, strlen(version), &fnv, &djb);
+
+    if (!hash_source_file(path, 0, &fnv, &djb, &size))
+    {
+        return false;
+    }
+
+    sprintf(key, "%08lx%08lx%016lx", fnv, djb, size);
+    return true;
+}
+
+/*
+ * Copies exactly 'size' bytes from one stream to another (or skips them if 'to' is NULL).
+ * Returns false if the input ended early.
+ */
+static bool copy_bytes(FILE *from, FILE *to, unsigned long size)
+{
+    char chunk[4096];
+    size_t read;
+
+    while (size > 0)
+    {
+        read = fread(chunk, 1, size < sizeof(chunk) ? size : sizeof(chunk), from);
+        if (read == 0)
+        {
+            return false;
+        }
+        if (to != NULL)
+        {
+            fwrite(chunk, 1, read, to);
+        }
+        size -= read;
+    }
+
+    return true;
+}
+
+/*
+ * Returns the index of an output ending, or -1 if it is not one.
+ */
+static int ending_index(const char *ending)
+{
+    int i;
+
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+    {
+        if (strcmp(ending, output_endings[i]) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Reads a cache entry and applies it: writes the stored outputs, removes
+ * the ones the original run deleted, and prints the stored messages.
+ * The whole entry is checked before anything is touched, so a broken entry is just a miss.
+ */
+bool replay_cache_entry(const char *key, const char *filename, bool *success)
+{
+    char path[MAX_CACHE_PATH + CACHE_KEY_LENGTH + 1], line[MAX_LINE_LENGTH], ending[MAX_LINE_LENGTH];
+    char output[MAX_LINE_LENGTH];
+    unsigned long size;
+    bool valid = false;
+    FILE *entry, *fp;
+    int pass;
+
+    entry_path(path, key);
+    entry = fopen(path, "rb");
+    if (entry == NULL)
+    {
+        return false;
+    }
+
+    /* First pass validates the entry, second pass applies it */
+    for (pass = 0; pass < 2; pass++)
+    {
+        rewind(entry);
+
+        if (fgets(line, sizeof(line), entry) == NULL ||
+            strcmp(line, "ASSEMBLER-CACHE " ASSEMBLER_VERSION "\n") != 0 ||
+            fgets(line, sizeof(line), entry) == NULL)
+        {
+            break;
+        }
+
+        *success = strcmp(line, "STATUS ok\n") == 0;
+        valid = false;
+
+        while (fgets(line, sizeof(line), entry) != NULL)
+        {
+            if (strcmp(line, "END\n") == 0)
+            {
+                valid = true;
+                break;
+            }
+            else if (sscanf(line, "DIAGNOSTICS %lu", &size) == 1)
+            {
+                if (!copy_bytes(entry, pass == 1 ? diagnostics_stream() : NULL, size))
+                    break;
+            }
+            else if (sscanf(line, "FILE %80s %lu", ending, &size) == 2 && ending_index(ending) != -1)
+            {
+                fp = NULL;
+                if (pass == 1)
+                {
+                    add_ending_to_string(output, filename, ending);
+                    fp = fopen(output, "w");
+                }
+                if (!copy_bytes(entry, fp, size))
+                {
+                    if (fp != NULL)
+                        fclose(fp);
+                    break;
+                }
+                if (fp != NULL)
+                    fclose(fp);
+            }
+            else if (sscanf(line, "REMOVE %80s", ending) == 1 && ending_index(ending) != -1)
+            {
+                if (pass == 1)
+                {
+                    add_ending_to_string(output, filename, ending);
+                    remove(output);
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (!valid)
+        {
+            break;
+        }
+    }
+
+    fclose(entry);
+    return valid;
+}
+
+/*
+ * Records whether every output file exists, and its size and modification time.
+ */
+void snapshot_outputs(const char *filename, output_snapshot snapshot[OUTPUT_ENDINGS])
+{
+    char path[MAX_LINE_LENGTH];
+    struct stat info;
+    int i;
+
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+    {
+        add_ending_to_string(path, filename, output_endings[i]);
+        snapshot[i].exists = stat(path, &info) == 0;
+        snapshot[i].size = snapshot[i].exists ? (long)info.st_size : 0;
+        snapshot[i].modified = snapshot[i].exists ? info.st_mtim.tv_sec : 0;
+        snapshot[i].modified_nsec = snapshot[i].exists ? info.st_mtim.tv_nsec : 0;
+    }
+}
+
+/*
+ * Compares the outputs with their state before the run: a file that changed was written
+ * by the run and is stored, a file that is missing is recorded as removed,
+ * and a file the run didn't touch is left out of the entry.
+ */
+void store_cache_entry(const char *key, const char *filename, output_snapshot before[OUTPUT_ENDINGS],
+                       diagnostics_buffer *diagnostics, bool success)
+{
+    char path[MAX_CACHE_PATH + CACHE_KEY_LENGTH + 1], temp_path[MAX_CACHE_PATH + CACHE_KEY_LENGTH + 8];
+    char output[MAX_LINE_LENGTH];
+    output_snapshot after[OUTPUT_ENDINGS];
+    FILE *entry, *fp;
+    int i, fd;
+
+    snapshot_outputs(filename, after);
+
+    entry_path(path, key);
+    sprintf(temp_path, "%s.XXXXXX", path);
+    fd = mkstemp(temp_path);
+    if (fd == -1)
+    {
+        return; /* The cache is best effort */
+    }
+
+    entry = fdopen(fd, "wb");
+    if (entry == NULL)
+    {
+        close(fd);
+        remove(temp_path);
+        return;
+    }
+
+    fprintf(entry, "ASSEMBLER-CACHE %s\nSTATUS %s\n", ASSEMBLER_VERSION, success ? "ok" : "failed");
+    fprintf(entry, "DIAGNOSTICS %lu\n", (unsigned long)diagnostics->size);
+    fwrite(diagnostics->text, 1, diagnostics->size, entry);
+
+    for (i = 0; i < OUTPUT_ENDINGS; i++)
+    {
+        add_ending_to_string(output, filename, output_endings[i]);
+
+        if (!after[i].exists)
+        {
+            fprintf(entry, "REMOVE %s\n", output_endings[i]);
+        }
+        else if (!before[i].exists || before[i].size != after[i].size ||
+                 before[i].modified != after[i].modified || before[i].modified_nsec != after[i].modified_nsec)
+        {
+            fp = fopen(output, "rb");
+            if (fp == NULL)
+            {
+                fclose(entry);
+                remove(temp_path);
+                return;
+            }
+            fprintf(entry, "FILE %s %lu\n", output_endings[i], (unsigned long)after[i].size);
+            copy_bytes(fp, entry, after[i].size);
+            fclose(fp);
+        }
+    }
+
+    fprintf(entry, "END\n");
+
+    /* rename() replaces the entry atomically, even if another worker stored the same key */
+    if (fclose(entry) != 0 || rename(temp_path, path) != 0)
+    {
+        remove(temp_path);
+    }
+}
+
+/*
+ * Replays the stored result on a hit. On a miss, assembles the file while collecting
+ * its messages, passes them on to the current output, and stores the result.
+ */
+bool process_file_cached(assembler_table *assembler, char *filename)
+{
+    char key[CACHE_KEY_LENGTH];
+    output_snapshot before[OUTPUT_ENDINGS];
+    diagnostics_buffer diagnostics;
+    bool success;
+
+    /* A missing source is reported by the normal path */
+    if (!compute_cache_key(filename, assembler->options, key))
+    {
+        return run_assembly_stages(assembler, filename);
+    }
+
+    if (replay_cache_entry(key, filename, &success))
+    {
+        return success;
+    }
+
+    snapshot_outputs(filename, before);
+
+    if (!begin_buffered_diagnostics(&diagnostics))
+    {
+        return run_assembly_stages(assembler, filename);
+    }
+
+    success = run_assembly_stages(assembler, filename);
+
+    end_buffered_diagnostics(&diagnostics);
+    fwrite(diagnostics.text, 1, diagnostics.size, diagnostics_stream());
+
+    store_cache_entry(key, filename, before, &diagnostics, success);
+    free(diagnostics.text);
+
+    return success;
+}
@@ -0,0 +1,108 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "assembler.h"
+
+/* ============================ Result cache ================================== */
+
+/*
+ * The cache keeps the result of assembling a source, keyed by a hash of the
+ * .as contents, the assembler version and the options that change the outputs. The path
+ * and contents of every file the source includes (and of the files they include) are part
+ * of the hash too. An entry is one file in the cache directory, written under a temporary
+ * name and renamed into place:
+ *
+ *     ASSEMBLER-CACHE <version>
+ *     STATUS ok | failed
+ *     DIAGNOSTICS <n>              followed by exactly n bytes of messages
+ *     FILE <ending> <n>            followed by the n bytes of an output file
+ *     REMOVE <ending>              an output file the run deleted
+ *     END
+ */
+
+/* Maximum length of the cache directory path */
+#define MAX_CACHE_PATH 4096
+
+/* Length of a cache key: two 32 bit hashes and the file size in hex, plus '\0' */
+#define CACHE_KEY_LENGTH 33
+
+/* Nesting of included files the key follows; a source that goes deeper isn't cached */
+#define CACHE_INCLUDE_DEPTH 32
+
+/* Number of output files a run can touch */
+#define OUTPUT_ENDINGS 4
+
+/* State of one output file before a run, to find which files the run wrote */
+typedef struct output_snapshot
+{
+    bool exists;        /* Whether the file existed */
+    long size;          /* Its size */
+    time_t modified;    /* Its modification time (seconds) */
+    long modified_nsec; /* Its modification time (nanoseconds) */
+} output_snapshot;
+
+/**
+ * Enables the cache, storing entries in the given directory (created if needed).
+ *
+ * @param directory The cache directory.
+ */
+void set_cache_directory(const char *directory);
+
+/**
+ * @return true if a cache directory was set.
+ */
+bool cache_enabled(void);
+
+/**
+ * Assembles a file through the cache: replays a stored result if the source
+ * is unchanged, otherwise assembles it and stores the result.
+ *
+ * @param assembler The table to use on a miss.
+ * @param filename The file name (without extension).
+ * @return true if the file was (or had been) processed successfully.
+ */
+bool process_file_cached(assembler_table *assembler, char *filename);
+
+/**
+ * Computes the cache key of a source from its contents, the assembler version and the options.
+ *
+ * @param filename The file name (without extension).
+ * @param options The options of the run.
+ * @param key Output: the key.
+ * @return true if the source and the files it includes could be read.
+ */
+bool compute_cache_key(const char *filename, const assembler_options *options, char key[CACHE_KEY_LENGTH]);
+
+/**
+ * Restores the outputs and replays the diagnostics of a cache entry.
+ *
+ * @param key The cache key.
+ * @param filename The file name (without extension).
+ * @param success Output: the status the original run returned.
+ * @return true on a hit, false if there is no valid entry.
+ */
+bool replay_cache_entry(const char *key, const char *filename, bool *success);
+
+/**
+ * Writes a cache entry for a run that just finished.
+ *
+ * @param key The cache key.
+ * @param filename The file name (without extension).
+ * @param before The state of the outputs before the run.
+ * @param diagnostics The buffered messages of the run.
+ * @param success The result of the run.
+ */
+void store_cache_entry(const char *key, const char *filename, output_snapshot before[OUTPUT_ENDINGS],
+                       diagnostics_buffer *diagnostics, bool success);
+
+/**
+ * Records the state of the output files of a source.
+ *
+ * @param filename The file name (without extension).
+ * @param snapshot Output: one entry per output ending.
+ */
+void snapshot_outputs(const char *filename, output_snapshot snapshot[OUTPUT_ENDINGS]);
+
+#endif /* CACHE_H */
@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdarg.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include "assembler.h"
+#include "diagnostics.h"
+
+/* Keys of the per thread diagnostics buffer and recovery point, created once on first use */
+static pthread_key_t buffer_key;
+static pthread_key_t recovery_key;
+static pthread_key_t recovery_buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+/* Where unbuffered messages go, NULL for stdout */
+static FILE *default_stream = NULL;
+
+/*
+ * Creates the keys that hold the diagnostics buffer and the recovery point of each thread.
+ */
+static void create_buffer_key(void)
+{
+    pthread_key_create(&buffer_key, NULL);
+    pthread_key_create(&recovery_key, NULL);
+    pthread_key_create(&recovery_buffer_key, NULL);
+}
+
+/*
+ * Returns the active diagnostics buffer of the current thread, or NULL.
+ */
+static diagnostics_buffer *current_buffer(void)
+{
+    pthread_once(&buffer_key_once, create_buffer_key);
+    return pthread_getspecific(buffer_key);
+}
+
+/*
+ * Changes the stream used when no buffer is active.
+ */
+void set_diagnostics_output(FILE *stream)
+{
+    default_stream = stream;
+}
+
+/*
+ * Returns the diagnostics stream of the current thread, stdout by default.
+ */
+FILE *diagnostics_stream(void)
+{
+    diagnostics_buffer *buffer = current_buffer();
+
+    if (buffer != NULL)
+    {
+        return buffer->stream;
+    }
+
+    return default_stream != NULL ? default_stream : stdout;
+}
+
+/*
+ * Opens a memory stream for the buffer and makes it the thread's output.
+ */
+int begin_buffered_diagnostics(diagnostics_buffer *buffer)
+{
+    buffer->text = NULL;
+    buffer->size = 0;
+    buffer->previous = NULL;
+    buffer->keep_records = 0;
+    buffer->records = NULL;
+    buffer->last_record = NULL;
+    buffer->pending_line = -1;
+    buffer->stream = open_memstream(&buffer->text, &buffer->size);
+
+    if (buffer->stream == NULL)
+    {
+        return 0;
+    }
+
+    attach_diagnostics_buffer(buffer);
+    return 1;
+}
+
+/*
+ * Same as begin_buffered_diagnostics(), but every message is also kept as a record.
+ */
+int begin_recorded_diagnostics(diagnostics_buffer *buffer)
+{
+    if (!begin_buffered_diagnostics(buffer))
+    {
+        return 0;
+    }
+
+    buffer->keep_records = 1;
+    return 1;
+}
+
+/*
+ * Makes an open buffer the output of the current thread.
+ */
+void attach_diagnostics_buffer(diagnostics_buffer *buffer)
+{
+    buffer->previous = current_buffer();
+    pthread_setspecific(buffer_key, buffer);
+}
+
+/*
+ * Goes back to the output that was active before the buffer was attached.
+ */
+void detach_diagnostics_buffer(diagnostics_buffer *buffer)
+{
+    if (current_buffer() == buffer)
+    {
+        pthread_setspecific(buffer_key, buffer->previous);
+    }
+}
+
+/*
+ * Closes the memory stream of the buffer, and goes back to the previous output.
+ */
+void end_buffered_diagnostics(diagnostics_buffer *buffer)
+{
+    detach_diagnostics_buffer(buffer);
+
+    if (buffer->stream != NULL)
+    {
+        fclose(buffer->stream);
+        buffer->stream = NULL;
+    }
+}
+
+/*
+ * Prints a printf style message to the diagnostics stream of the current thread.
+ */
+void diagnostic_printf(const char *format, ...)
+{
+    diagnostics_buffer *buffer = current_buffer();
+    diagnostic_record *record;
+    va_list args;
+    int length;
+
+    va_start(args, format);
+    vfprintf(diagnostics_stream(), format, args);
+    va_end(args);
+
+    if (buffer == NULL || !buffer->keep_records)
+    {
+        return;
+    }
+
+    /* Every call is one message */
+    va_start(args, format);
+    length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    /* Not my_malloc(), whose own error message would come back here */
+    record = malloc(sizeof(diagnostic_record));
+    if (record == NULL || (record->message = malloc(length + 1)) == NULL)
+    {
+        free(record);
+        return;
+    }
+
+    va_start(args, format);
+    vsnprintf(record->message, length + 1, format, args);
+    va_end(args);
+
+    if (length > 0 && record->message[length - 1] == '\n')
+    {
+        record->message[length - 1] = '\0';
+    }
+
+    record->line = buffer->pending_line;
+    record->next = NULL;
+    buffer->pending_line = -1;
+
+    if (buffer->last_record != NULL)
+    {
+        buffer->last_record->next = record;
+    }
+    else
+    {
+        buffer->records = record;
+    }
+    buffer->last_record = record;
+}
+
+/*
+ * Remembers the line of the next message, for recording buffers.
+ */
+void diagnostic_line(int line)
+{
+    diagnostics_buffer *buffer = current_buffer();
+
+    if (buffer != NULL)
+    {
+        buffer->pending_line = line;
+    }
+}
+
+/*
+ * Frees a list of records.
+ */
+void free_diagnostic_records(diagnostic_record *records)
+{
+    diagnostic_record *next;
+
+    while (records != NULL)
+    {
+        next = records->next;
+        free(records->message);
+        free(records);
+        records = next;
+    }
+}
+
+/*
+ * Sets or clears the point a fatal error of this thread jumps back to,
+ * and remembers the buffer that is active there.
+ */
+void set_fatal_recovery(jmp_buf *target)
+{
+    pthread_once(&buffer_key_once, create_buffer_key);
+    pthread_setspecific(recovery_key, target);
+    pthread_setspecific(recovery_buffer_key, target != NULL ? current_buffer() : NULL);
+}
+
+/*
+ * The buffers opened after the recovery point live in the frames the jump leaves.
+ * Closes them from the innermost out, appending each one to the one before it,
+ * and frees them, so the thread is back on the buffer of the recovery point.
+ */
+static void unwind_diagnostics(diagnostics_buffer *outer)
+{
+    diagnostics_buffer *buffer, *previous;
+
+    while ((buffer = current_buffer()) != NULL && buffer != outer)
+    {
+        end_buffered_diagnostics(buffer);
+        fwrite(buffer->text, 1, buffer->size, diagnostics_stream());
+        free(buffer->text);
+
+        /* A recording buffer keeps the records too */
+        previous = current_buffer();
+        if (previous != NULL && previous->keep_records && buffer->records != NULL)
+        {
+            if (previous->last_record != NULL)
+            {
+                previous->last_record->next = buffer->records;
+            }
+            else
+            {
+                previous->records = buffer->records;
+            }
+            previous->last_record = buffer->last_record;
+        }
+        else
+        {
+            free_diagnostic_records(buffer->records);
+        }
+        buffer->text = NULL;
+        buffer->records = NULL;
+    }
+}
+
+/*
+ * Jumps back to the recovery point of the thread if it has one,
+ * and otherwise exits, keeping the buffered messages.
+ */
+void fatal_exit(void)
+{
+    jmp_buf *target;
+
+    pthread_once(&buffer_key_once, create_buffer_key);
+    target = pthread_getspecific(recovery_key);
+
+    if (target != NULL)
+    {
+        unwind_diagnostics(pthread_getspecific(recovery_buffer_key));
+        longjmp(*target, 1);
+    }
+
+    release_diagnostics();
+    exit(1);
+}
+
+/*
+ * Before a fatal exit, the messages a worker buffered would be lost with its streams.
+ * Closes the buffers from the innermost out, appending each one to the one before it,
+ * so everything ends up on the default output in the order it was printed.
+ */
+void release_diagnostics(void)
+{
+    diagnostics_buffer *buffer;
+
+    while ((buffer = current_buffer()) != NULL)
+    {
+        end_buffered_diagnostics(buffer);
+        fwrite(buffer->text, 1, buffer->size, diagnostics_stream());
+    }
+
+    fflush(diagnostics_stream());
+}
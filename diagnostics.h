@@ -0,0 +1,140 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdio.h>
+#include <setjmp.h>
+
+/* ============================ Diagnostics output ================================== */
+
+/**
+ * Every error message of the assembler is printed through this module.
+ * By default the messages go straight to stdout, but a thread that assembles
+ * one file of a batch can collect them in a buffer, so the messages of each
+ * file are kept together and printed as one block.
+ */
+
+/* One message, kept by a recording buffer */
+typedef struct diagnostic_record
+{
+    int line;                        /* Source line of the message, -1 if it has none */
+    char *message;                   /* The message, without the trailing newline */
+    struct diagnostic_record *next;  /* The next message */
+} diagnostic_record;
+
+/* Messages collected in memory for one file */
+typedef struct diagnostics_buffer
+{
+    FILE *stream;                         /* Memory stream the messages are written to */
+    char *text;                           /* The collected text (valid after the stream is flushed) */
+    size_t size;                          /* Length of the collected text */
+    struct diagnostics_buffer *previous;  /* The buffer that was active before this one, if any */
+    int keep_records;                     /* Also keep every message as a record */
+    diagnostic_record *records;           /* The kept messages, in order */
+    diagnostic_record *last_record;       /* The last kept message */
+    int pending_line;                     /* Line of the next message, -1 if unknown */
+} diagnostics_buffer;
+
+/**
+ * Prints a diagnostic message to the current thread's output.
+ * Takes the same arguments as printf.
+ *
+ * @param format The printf format of the message.
+ */
+void diagnostic_printf(const char *format, ...);
+
+/**
+ * Sets the stream unbuffered diagnostics are written to, instead of stdout.
+ * Used when stdout carries the assembled output itself.
+ * Must be called before any worker thread is started.
+ *
+ * @param stream The new default output.
+ */
+void set_diagnostics_output(FILE *stream);
+
+/**
+ * Returns the stream that diagnostics of the current thread are written to.
+ *
+ * @return The stream of the active buffer, or the default output (stdout) if no buffer is active.
+ */
+FILE *diagnostics_stream(void);
+
+/**
+ * Starts collecting the diagnostics of the current thread into the given buffer.
+ * Buffers can be nested: when this one ends, the previous one becomes active again.
+ *
+ * @param buffer The buffer to fill.
+ * @return 1 if the buffer was opened, 0 if it could not be (messages keep going to stdout).
+ */
+int begin_buffered_diagnostics(diagnostics_buffer *buffer);
+
+/**
+ * Like begin_buffered_diagnostics(), but also keeps every message in buffer->records,
+ * with the line it refers to, for callers that want the messages one by one.
+ * The records belong to the caller, who frees them with free_diagnostic_records().
+ *
+ * @param buffer The buffer to fill.
+ * @return 1 if the buffer was opened, 0 if it could not be.
+ */
+int begin_recorded_diagnostics(diagnostics_buffer *buffer);
+
+/**
+ * Sets the source line of the next diagnostic, for recording buffers.
+ *
+ * @param line The line number, or -1 if the message has none.
+ */
+void diagnostic_line(int line);
+
+/**
+ * Frees a list of diagnostic records.
+ *
+ * @param records The first record, may be NULL.
+ */
+void free_diagnostic_records(diagnostic_record *records);
+
+/**
+ * Stops collecting diagnostics into the buffer, and goes back to the previous buffer (or stdout).
+ * The text stays in buffer->text until it is freed by the caller.
+ *
+ * @param buffer The buffer that was passed to begin_buffered_diagnostics().
+ */
+void end_buffered_diagnostics(diagnostics_buffer *buffer);
+
+/**
+ * Makes a buffer that is already open the output of the current thread.
+ * Lets the stages of a pipeline, running on different threads, add to the same file's messages.
+ *
+ * @param buffer A buffer opened with begin_buffered_diagnostics().
+ */
+void attach_diagnostics_buffer(diagnostics_buffer *buffer);
+
+/**
+ * Stops writing the current thread's diagnostics into the buffer, without closing it.
+ *
+ * @param buffer The attached buffer.
+ */
+void detach_diagnostics_buffer(diagnostics_buffer *buffer);
+
+/**
+ * Flushes all the diagnostics buffered by the current thread to the default output before a fatal exit,
+ * and routes the rest of its messages straight to it.
+ */
+void release_diagnostics(void);
+
+/**
+ * Sets the point that fatal errors of the current thread jump back to, instead of exiting.
+ * Used by the library, which must never end the program it is embedded in.
+ * The buffers opened after this call are closed by the jump, and their messages
+ * go to the buffer that is active now.
+ *
+ * @param target The recovery point set with setjmp(), or NULL to exit again.
+ */
+void set_fatal_recovery(jmp_buf *target);
+
+/**
+ * Ends the handling of a fatal error (failed allocation, open or remove), after it was reported:
+ * jumps back to the thread's recovery point if one is set, and otherwise
+ * releases the buffered diagnostics and exits with status 1.
+ */
+void fatal_exit(void);
+
+#endif /* DIAGNOSTICS_H */
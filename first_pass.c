@@ -3,9 +3,10 @@
 #include "first_pass_functions.h"
 
 /**
- * Executes the first pass over the processed assembly source file (file_name.am).
+ * Executes the first pass over the processed assembly source.
  *
- * This function processes the '.am' file line by line.
+ * This function processes the macro expanded source, that the preprocessor
+ * left in the table, line by line (the same text that goes to the '.am' file).
  * It builds the assembler table by recording label names, their memory addresses,
  * and the type of input they have, while also announcing errors.
  *
@@ -14,11 +15,12 @@
  * + Store data and update the Data Counter.
  * + Update the Instruction Counter.
  *
- * Errors during this pass will be counted,
+ * Errors during this pass will be counted (in the table, with the errors of the other stages),
  * but will not stop the program immediately, 
- * only after the passed has finished scanning the file.
+ * only after the passed has finished scanning the file,
+ * or as soon as the --max-errors limit is reached.
  *
- * @param file  The name of the '.am' file to read.
+ * @param file  The name of the source file (without extension).
  * @param table The assembler_table structure.
  *
  * @return true (1) if the pass completed successfully without errors, 
@@ -27,12 +29,13 @@
 
 int first_pass(const char *file, assembler_table *table) 
 {
-    int error_count = 0; /* Counts the amount of errors */
-    char *full_file = my_malloc(strlen(file) + 4); /* File name + .am */
-    char line[MAX_LINE_LENGTH]; /* A variable to include the lines of the am file */
+    int *error_count = &table->error_count; /* Counts the amount of errors */
+    char line[MAX_LINE_LENGTH]; /* A variable to include the lines of the expanded source */
     int line_number = 0; /* Counts the amount of lines in the file */
-    FILE *am; /* A variable to include the opened am file */
+    long position = 0; /* The read position in the expanded source */
     bool label_flag = false;
+    long expansion = 0; /* The macro call the line may belong to */
+    compiled_line *compiled;
 
     /* 0-ing the table */
     table->instruction_counter = 100;
@@ -40,43 +43,40 @@ int first_pass(const char *file, assembler_table *table)
     table->label_list = NULL;
     table->data_section = NULL;
     
-    /* Adds .am to the file name */
-    add_ending_to_string(full_file, file, ".am");
-
-    /* Opens 'file.am' */
-    am = fopen(full_file, "r");
-
-    /* Checks if file was opened. Prints error if no. */
-    if (!am) 
-    {
-        first_pass_errors(ERR_AM_FILE, -1, -1);
-        return 0;
-    }
-    
-    /* Checks every line of the file to insert into the table. */
-    while (fgets(line, MAX_LINE_LENGTH, am)) 
+    /* Checks every line of the expanded source to insert into the table. */
+    while (!error_limit_reached(table) && read_text_buffer_line(&table->expanded_source, &position, line)) 
     {
         line_number++;
-        check_line(line, line_number ,table, &error_count, label_flag);
-    }
-
-    add_entry_addresses(table, &error_count);
 
-    /* Closes files and frees memory */
-    fclose(am);
-    free(full_file);
+        /* A line of a macro body is only parsed on the first expansion of the macro */
+        compiled = find_compiled_line(table, line_number, &expansion);
+        if (compiled != NULL)
+        {
+            check_macro_line(line, line_number, table, error_count, compiled);
+        }
+        else
+        {
+            check_line(line, line_number ,table, error_count, label_flag);
+        }
+    }
 
-    /* Checks if the memory limit was exceeded. Prints error if yes. */
-    if (table->data_counter + table->instruction_counter > MAX_MEMORY)
+    /* After too many errors, the rest of the checks are skipped too */
+    if (!error_limit_reached(table))
     {
-        first_pass_errors(ERR_MAX_MEMORY, -1, error_count);
-        error_count++;
+        add_entry_addresses(table, error_count);
+
+        /* Checks if the memory limit was exceeded. Prints error if yes. */
+        if (table->data_counter + table->instruction_counter > MAX_MEMORY)
+        {
+            first_pass_errors(ERR_MAX_MEMORY, -1, *error_count);
+            (*error_count)++;
+        }
     }
 
     /* Checks if there were any errors. Prints error if yes, and stops the program. */
-    if (error_count != 0)
+    if (*error_count != 0)
     {
-        first_pass_errors(ERR_AMOUNT_OF_ERRORS, -1, error_count);
+        first_pass_errors(ERR_AMOUNT_OF_ERRORS, -1, *error_count);
         return(false);
     }
 
@@ -180,6 +180,7 @@ bool check_two_operands(char *line, int i, int *error_count, char *name, int lin
 {
     char temp_line[MAX_LINE_LENGTH];
     char *src = NULL, *dest = NULL;
+    char *cursor = temp_line;
     int count = 0; /* Counts the number of operands */
     bool src_ok = false, dest_ok = false;
 
@@ -201,13 +202,13 @@ bool check_two_operands(char *line, int i, int *error_count, char *name, int lin
     }
 
     /* Gets first operand */
-    src = strtok(temp_line, ", \t\n");
+    src = next_token(&cursor, ", \t\n");
     if (src) 
     {
         count++;
         
         /* Gets second operand */
-        dest = strtok(NULL, ", \t\n");
+        dest = next_token(&cursor, ", \t\n");
         if (dest) 
         {
             count++;
@@ -215,7 +216,7 @@ bool check_two_operands(char *line, int i, int *error_count, char *name, int lin
     }
 
     /* Checks if there were more than 2 operands */
-    if (strtok(NULL, ", \t\n") != NULL) 
+    if (next_token(&cursor, ", \t\n") != NULL) 
     {
         count++; 
     }
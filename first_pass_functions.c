@@ -469,11 +469,12 @@ void extract_operands(char *line, int command_start_i, int command_len, char *sr
     char *second = NULL; /* Stores the dst operand */
     char *after_command = &line[command_start_i + command_len];
     char copy[MAX_LINE_LENGTH]; /* Stores a copy of the line variable */
+    char *cursor = copy; /* The position of the next operand in the copy */
 
     strcpy(copy, after_command);
 
-    first = strtok(copy, ", \t\n");
-    second = strtok(NULL, ", \t\n");
+    first = next_token(&cursor, ", \t\n");
+    second = next_token(&cursor, ", \t\n");
 
     if (operand_count == 1 && first)
     {
@@ -532,6 +533,13 @@ void encode_command(assembler_table *table, int opcode, char *src_oper, char *de
         dest_mode = -1;
     }
 
+    /* A syntax check only needs the addresses and the label references */
+    if (table->options->check_only)
+    {
+        reserve_command_words(table, src_oper, src_mode, dest_oper, dest_mode, lbl);
+        return;
+    }
+
     /* Stores the opcode value in the struct */
     word.opcode = opcode;
 
@@ -640,6 +648,64 @@ unsigned short command_to_short(command_parts *parts)
     return result;
 }
 
+/**
+ * Advances the IC over the words of a command without encoding them.
+ * Only the words that reference a label are added to the code section,
+ * so the second pass can still report undefined labels.
+ *
+ * @param table     The assembler table to store commands.
+ * @param src_oper  Source operand, NULL if there isnt one.
+ * @param src_mode  Addressing mode of the source operand, -1 if there isnt one.
+ * @param dest_oper Destination operand, NULL if there isnt one.
+ * @param dest_mode Addressing mode of the destination operand, -1 if there isnt one.
+ * @param lbl       The name of the label
+ */
+void reserve_command_words(assembler_table *table, char *src_oper, int src_mode, char *dest_oper, int dest_mode, char *lbl)
+{
+    /* The first word */
+    if (lbl != NULL && lbl[0] != '\0')
+        create_and_add_command(table, 0, lbl);
+    else
+        table->instruction_counter++;
+
+    /* Two registers share one word */
+    if (src_mode == 3 && dest_mode == 3)
+    {
+        table->instruction_counter++;
+        return;
+    }
+
+    reserve_operand_words(table, src_oper, src_mode);
+    reserve_operand_words(table, dest_oper, dest_mode);
+}
+
+/**
+ * Advances the IC over the words of one operand, keeping its label reference.
+ *
+ * @param table The assembler table to store commands.
+ * @param oper  The operand.
+ * @param mode  Its addressing mode, -1 if there is no operand.
+ */
+void reserve_operand_words(assembler_table *table, char *oper, int mode)
+{
+    switch (mode)
+    {
+    case 0: /* Immediate */
+    case 3: /* Register */
+        table->instruction_counter++;
+        break;
+
+    case 1: /* Label */
+        create_and_add_command(table, 0, oper);
+        break;
+
+    case 2: /* Matrix */
+        create_and_add_command(table, 0, oper);
+        table->instruction_counter++;
+        break;
+    }
+}
+
 /**
  * Builds the extra word that encodes the two index-registers of a matrix operand.
  *
@@ -686,6 +752,7 @@ void add_directive(assembler_table *table, char *line, int *error_count, char *d
         if (input != NULL)
         {
             char copy_of_line[MAX_LINE_LENGTH];
+            char *cursor = copy_of_line;
             char *arg;
 
             int value;
@@ -700,7 +767,7 @@ void add_directive(assembler_table *table, char *line, int *error_count, char *d
             strcpy(copy_of_line, input);
 
             /* Splits the part with the , into mutiple arguments */
-            arg = strtok(copy_of_line, ",");
+            arg = next_token(&cursor, ",");
             while (arg != NULL)
             {
                 data *new_directive = (data *)my_malloc(sizeof(data));
@@ -723,7 +790,7 @@ void add_directive(assembler_table *table, char *line, int *error_count, char *d
                 /* Add the node to the list */
                 add_data_node(table, new_directive);
 
-                arg = strtok(NULL, ",");
+                arg = next_token(&cursor, ",");
 
             }
         }
@@ -788,6 +855,7 @@ void add_directive(assembler_table *table, char *line, int *error_count, char *d
         int i = (int)(input - line);
 
         char copy_of_line[MAX_LINE_LENGTH]; /* Holds a copy of our line, so that it won't be ruined */
+        char *cursor = copy_of_line; /* The position of the next argument in the copy */
 
         char *arg;
 
@@ -824,7 +892,7 @@ void add_directive(assembler_table *table, char *line, int *error_count, char *d
         copy_of_line[MAX_LINE_LENGTH - 1] = '\0';
 
         /* Seperates arguments */
-        arg = strtok(copy_of_line, ",");
+        arg = next_token(&cursor, ",");
 
         while (arg != NULL)
         {
@@ -856,7 +924,7 @@ void add_directive(assembler_table *table, char *line, int *error_count, char *d
 
             count++; /* Adds an argument to the counter */
 
-            arg = strtok(NULL, ",");
+            arg = next_token(&cursor, ",");
         }
 
         /* Checks if the amount of numbers is exactly the amount neede to fill the given matrix */
@@ -1189,3 +1257,173 @@ void add_command_node(assembler_table *table, command *new_node)
         temp->next = new_node;
     }
 }
+
+/* ############################### Compiled Macro Lines ############################### */
+
+/**
+ * Finds the compiled form of a line of the expanded source, if the line comes from a macro body.
+ * The macro calls are in the order of the lines, so the search goes on from the previous line.
+ *
+ * @param table        The assembler's table structure.
+ * @param line_number  The number of the line in the expanded source.
+ * @param expansion    The index of the macro call of the previous line, advanced with the lines.
+ *
+ * @return The compiled line, or NULL if the line isn't part of a macro call.
+ */
+compiled_line *find_compiled_line(assembler_table *table, int line_number, long *expansion)
+{
+    expansion_map *map = &table->expansions;
+    macro *source;
+
+    /* Skips the calls that ended before this line */
+    while (*expansion < map->count &&
+           line_number >= map->items[*expansion].first_line + map->items[*expansion].source->line_count)
+    {
+        (*expansion)++;
+    }
+
+    if (*expansion == map->count || line_number < map->items[*expansion].first_line)
+    {
+        return NULL;
+    }
+
+    source = map->items[*expansion].source;
+
+    /* Nothing is compiled before the first expansion */
+    if (source->compiled == NULL)
+    {
+        source->compiled = arena_alloc(&table->macro_storage, sizeof(compiled_line) * source->line_count);
+        memset(source->compiled, 0, sizeof(compiled_line) * source->line_count);
+    }
+
+    return &source->compiled[line_number - map->items[*expansion].first_line];
+}
+
+/**
+ * Checks a line of a macro body, or copies the words it compiled to.
+ *
+ * @param line         The line to check.
+ * @param line_number  The number of the line in the expanded source.
+ * @param table        The assembler's table structure.
+ * @param error_count  The number of errors found so far.
+ * @param compiled     The compiled line.
+ */
+void check_macro_line(char *line, int line_number, assembler_table *table, int *error_count, compiled_line *compiled)
+{
+    if (compiled->state == LINE_COMPILED)
+    {
+        replay_compiled_line(table, compiled);
+    }
+    else if (compiled->state == LINE_NOT_REUSABLE)
+    {
+        /* Labels and errors depend on the rest of the file, and the messages need the line number */
+        check_line(line, line_number, table, error_count, false);
+    }
+    else
+    {
+        compile_macro_line(line, line_number, table, error_count, compiled);
+    }
+}
+
+/**
+ * Checks the line, then keeps copies of the words it added if it added nothing else.
+ * The words are kept in the macro arena, with the macro.
+ *
+ * @param line         The line to check.
+ * @param line_number  The number of the line in the expanded source.
+ * @param table        The assembler's table structure.
+ * @param error_count  The number of errors found so far.
+ * @param compiled     The compiled line to fill.
+ */
+void compile_macro_line(char *line, int line_number, assembler_table *table, int *error_count, compiled_line *compiled)
+{
+    command *last_word = table->code_section, *cmd;
+    data *last_data = table->data_section, *d;
+    label *last_label = table->label_list;
+    external_label *externals = table->external_list;
+    int errors = *error_count, instruction_counter = table->instruction_counter, i;
+
+    /* Finds the ends of the lists before the line */
+    while (last_word != NULL && last_word->next != NULL)
+    {
+        last_word = last_word->next;
+    }
+    while (last_data != NULL && last_data->next != NULL)
+    {
+        last_data = last_data->next;
+    }
+    while (last_label != NULL && last_label->next != NULL)
+    {
+        last_label = last_label->next;
+    }
+
+    check_line(line, line_number, table, error_count, false);
+
+    /* A line with errors, labels, .entry or .extern has to be checked again every time */
+    if (*error_count != errors || table->external_list != externals ||
+        (last_label != NULL ? last_label->next != NULL : table->label_list != NULL))
+    {
+        compiled->state = LINE_NOT_REUSABLE;
+        return;
+    }
+
+    compiled->state = LINE_COMPILED;
+    compiled->instruction_count = table->instruction_counter - instruction_counter;
+
+    /* Copies the new code words, with addresses relative to the IC */
+    compiled->word_count = 0;
+    for (cmd = last_word != NULL ? last_word->next : table->code_section; cmd != NULL; cmd = cmd->next)
+    {
+        compiled->word_count++;
+    }
+    compiled->words = arena_alloc(&table->macro_storage, sizeof(command) * compiled->word_count);
+    for (i = 0, cmd = last_word != NULL ? last_word->next : table->code_section; cmd != NULL; cmd = cmd->next, i++)
+    {
+        compiled->words[i] = *cmd;
+        compiled->words[i].address -= instruction_counter;
+        compiled->words[i].next = NULL;
+    }
+
+    /* Copies the new data words, their addresses are the next DC values */
+    compiled->data_count = 0;
+    for (d = last_data != NULL ? last_data->next : table->data_section; d != NULL; d = d->next)
+    {
+        compiled->data_count++;
+    }
+    compiled->data_words = arena_alloc(&table->macro_storage, sizeof(data) * compiled->data_count);
+    for (i = 0, d = last_data != NULL ? last_data->next : table->data_section; d != NULL; d = d->next, i++)
+    {
+        compiled->data_words[i] = *d;
+        compiled->data_words[i].next = NULL;
+    }
+}
+
+/**
+ * Adds copies of the words of a compiled line, as if the line was checked again.
+ *
+ * @param table     The assembler's table structure.
+ * @param compiled  The compiled line.
+ */
+void replay_compiled_line(assembler_table *table, compiled_line *compiled)
+{
+    int i;
+
+    for (i = 0; i < compiled->word_count; i++)
+    {
+        command *new_command = (command *)my_malloc(sizeof(command));
+
+        *new_command = compiled->words[i];
+        new_command->address += table->instruction_counter;
+        add_command_node(table, new_command);
+    }
+    table->instruction_counter += compiled->instruction_count;
+
+    for (i = 0; i < compiled->data_count; i++)
+    {
+        data *new_data = (data *)my_malloc(sizeof(data));
+
+        *new_data = compiled->data_words[i];
+        new_data->address = table->data_counter;
+        add_data_node(table, new_data); /* Advances the DC */
+    }
+}
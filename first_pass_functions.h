@@ -140,6 +140,29 @@ void extract_operands(char *line, int command_start_i, int command_len, char *sr
  */
 void encode_command(assembler_table *table, int opcode, char *src_operand, char *dest_operand, char *lbl);
 
+/**
+ * @brief Reserves the words of a command in --check mode, without encoding them.
+ *
+ * Advances the IC like encode_command(), but only adds the words that reference a label.
+ *
+ * @param table     The assembler table to store commands.
+ * @param src_oper  Source operand, NULL if there isnt one.
+ * @param src_mode  Addressing mode of the source operand, -1 if there isnt one.
+ * @param dest_oper Destination operand, NULL if there isnt one.
+ * @param dest_mode Addressing mode of the destination operand, -1 if there isnt one.
+ * @param lbl       The name of the label
+ */
+void reserve_command_words(assembler_table *table, char *src_oper, int src_mode, char *dest_oper, int dest_mode, char *lbl);
+
+/**
+ * @brief Reserves the words of one operand in --check mode.
+ *
+ * @param table The assembler table to store commands.
+ * @param oper  The operand.
+ * @param mode  Its addressing mode, -1 if there is no operand.
+ */
+void reserve_operand_words(assembler_table *table, char *oper, int mode);
+
 /**
  * @brief Converts a command_parts structure into a machine word.
  *
@@ -257,4 +280,51 @@ void add_label_node(assembler_table *table, label *new_node);
  */
 void add_command_node(assembler_table *table, command *new_node);
 
+/* ############################### Compiled Macro Lines ############################### */
+
+/**
+ * @brief Finds the compiled form of a line of the expanded source, if the line comes from a macro body.
+ *
+ * The first time a macro is met, its compiled lines are allocated (not compiled yet).
+ *
+ * @param table        The assembler's table structure.
+ * @param line_number  The number of the line in the expanded source.
+ * @param expansion    The index of the macro call of the previous line, advanced with the lines.
+ *
+ * @return The compiled line, or NULL if the line isn't part of a macro call.
+ */
+compiled_line *find_compiled_line(assembler_table *table, int line_number, long *expansion);
+
+/**
+ * @brief Checks a line of a macro body: on the first expansion the line is checked and
+ * compiled, on the next ones the words it compiled to are copied.
+ *
+ * @param line         The line to check.
+ * @param line_number  The number of the line in the expanded source.
+ * @param table        The assembler's table structure.
+ * @param error_count  The number of errors found so far.
+ * @param compiled     The compiled line (see find_compiled_line()).
+ */
+void check_macro_line(char *line, int line_number, assembler_table *table, int *error_count, compiled_line *compiled);
+
+/**
+ * @brief Checks a line with check_line(), and keeps the words it added if that is
+ * all the line did, so the next expansions can reuse them.
+ *
+ * @param line         The line to check.
+ * @param line_number  The number of the line in the expanded source.
+ * @param table        The assembler's table structure.
+ * @param error_count  The number of errors found so far.
+ * @param compiled     The compiled line to fill.
+ */
+void compile_macro_line(char *line, int line_number, assembler_table *table, int *error_count, compiled_line *compiled);
+
+/**
+ * @brief Adds the words of a compiled line at the current IC and DC.
+ *
+ * @param table     The assembler's table structure.
+ * @param compiled  The compiled line.
+ */
+void replay_compiled_line(assembler_table *table, compiled_line *compiled);
+
 #endif /* FIRST_PASS_FUNCTIONS_H */
\ No newline at end of file
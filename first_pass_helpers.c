@@ -88,4 +88,45 @@ void check_double_comma(char *line, int line_number, int *error_count)
             (*error_count)++;
         }
     }
+}
+
+/**
+ * Returns the next token of the string, and moves the cursor after it.
+ *
+ * @param cursor      The position to continue from.
+ * @param delimiters  The characters that separate the tokens.
+ *
+ * @return The next token, or NULL if there are no more tokens.
+ */
+char *next_token(char **cursor, const char *delimiters)
+{
+    char *start = *cursor;
+    char *end;
+
+    if (start == NULL)
+    {
+        return NULL;
+    }
+
+    /* Skips the delimiters before the token */
+    start += strspn(start, delimiters);
+
+    if (*start == '\0')
+    {
+        *cursor = start;
+        return NULL;
+    }
+
+    /* Ends the token, and saves where the next one starts */
+    end = start + strcspn(start, delimiters);
+
+    if (*end != '\0')
+    {
+        *end = '\0';
+        end++;
+    }
+
+    *cursor = end;
+
+    return start;
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
  * + Removing comment symbols 
  * + Searching for command or directive keywords within a line
  * + Checking for a double comma 
+ * + Splitting operand lists into tokens without shared state
  */
 
 /**
@@ -54,4 +55,15 @@ int find_any_word_index(const char *line, const char *words[], int amount);
  */
 void check_double_comma(char *line, int line_number, int *error_count);
 
+/**
+ * Returns the next token of the string, like strtok(), but keeps its position in 'cursor'
+ * instead of a hidden static variable, so several files can be parsed at the same time.
+ *
+ * @param cursor      The position to continue from. Set it to the start of the string before the first call.
+ * @param delimiters  The characters that separate the tokens.
+ *
+ * @return The next token, or NULL if there are no more tokens.
+ */
+char *next_token(char **cursor, const char *delimiters);
+
 #endif /* FIRST_PASS_HELPERS_H */
\ No newline at end of file
@@ -13,28 +13,6 @@ void free_data_section(data *head)
     }
 }
 
-/*
- * Checks for invalid comment positioning in a line.
- * A comment (';') must appear only at the beginning of the line.
- */
-bool handle_notes_error(char line[], int line_counter)
-{
-    int i;
-
-    /* scan for comment ';' that appears after whitespace */
-    for (i = 1; i < strlen(line) - 1; i++)
-    {
-        if (isspace(line[i - 1]) && line[i] == ';')
-        {
-            /* report error*/
-            errors_table(ERROR_NOTE_WITH_SPACE, line_counter);
-            return false;
-        }
-    }
-
-    return true;
-}
-
 /* Free a linked list of command nodes */
 void free_code_section(command *head)
 {
@@ -88,31 +66,25 @@ void free_external_list(external_label *head)
     }
 }
 
-/* Free a linked list of macro_content nodes */
-void free_macro_content_list(macro_content *head)
+/* Free every block of an arena */
+void free_arena(arena *storage)
 {
-    macro_content *tmp;
-    while (head)
+    arena_block *tmp;
+    while (storage->blocks)
     {
-        tmp = head;
-        head = head->next;
+        tmp = storage->blocks;
+        storage->blocks = tmp->next;
         free(tmp);
-        tmp = NULL;
     }
 }
 
-/* Free a linked list of macro nodes, including their content */
-void free_macro_list(macro *head)
+/* Free the text of a text buffer */
+void free_text_buffer(text_buffer *buffer)
 {
-    macro *tmp;
-    while (head)
-    {
-        tmp = head;
-        head = head->next;
-        free_macro_content_list(tmp->content);
-        free(tmp);
-        tmp = NULL;
-    }
+    free(buffer->text);
+    buffer->text = NULL;
+    buffer->length = 0;
+    buffer->capacity = 0;
 }
 
 /*
@@ -128,7 +100,11 @@ void free_assembler_table(assembler_table *table)
     free_code_section(table->code_section);
     free_label_list(table->label_list);
     free_external_list(table->external_list);
-    free_macro_list(table->macro_list);
+    free_arena(&table->macro_storage);
+    free_macro_index(&table->macros);
+    free_macro_index(&table->library_macros);
+    free(table->expansions.items);
+    free_text_buffer(&table->expanded_source);
 
     /* Free the table struct itself */
     free(table);
@@ -153,7 +129,7 @@ void *my_malloc(long size)
     if (ptr == NULL)
     {
         errors_table(MALLOC_FAILED, -1);
-        exit(1); /* Exit the program if memory allocation fails */
+        fatal_exit(); /* Exit the program (or give up the file, in the library) */
     }
     return ptr; /* Return pointer to allocated memory */
 }
@@ -168,7 +144,7 @@ FILE *my_fopen(char *name, char *mode)
     if (fp == NULL)
     {
         errors_table(FAILED_TO_OPEN_FILE, -1);
-        exit(1);
+        fatal_exit(); /* Exit the program (or give up the file, in the library) */
     }
     return fp;
 }
@@ -187,199 +163,306 @@ void add_ending_to_string(char *dest, const char *file_name, const char *ending)
 }
 
 /*
- * Searches for a macro by name in a linked list of macros.
+ * Looks up a macro in the hash index. The name is hashed in place,
+ * so a line that isn't a macro call costs one scan of the line and usually one probe.
  */
-macro *find_macro(macro *head, char *name)
+macro *find_macro(const macro_index *index, const char *name)
 {
-    char temp[MAX_LINE_LENGTH];
-    memset(temp, '\0', MAX_LINE_LENGTH); /* Clear temp buffer */
+    size_t length;
+    unsigned long hash;
+    long slot;
+    macro *candidate;
 
-    my_tokenaizer(temp, name, '\n'); /* Remove trailing newline */
-    while (head != NULL)
+    if (index->count == 0)
+    {
+        return NULL; /* No macros yet */
+    }
+
+    hash = hash_macro_name(name, &length);
+
+    /* Probe from the home slot until an empty one */
+    for (slot = hash & (index->capacity - 1); (candidate = index->slots[slot]) != NULL; slot = (slot + 1) & (index->capacity - 1))
     {
         /* Compare macro name */
-        if (strcmp(head->macro_name, temp) == 0)
+        if (candidate->hash == hash && strncmp(candidate->macro_name, name, length) == 0 && candidate->macro_name[length] == '\0')
         {
-            return head;
+            return candidate;
         }
-        head = head->next;
     }
 
     return NULL; /* Not found */
 }
 
+/*
+ * Hashes the name up to its trailing newline, or the arguments of a call (FNV-1a).
+ */
+unsigned long hash_macro_name(const char *name, size_t *length)
+{
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; name[i] != '\0' && name[i] != '\n' && name[i] != '('; i++)
+    {
+        hash = ((hash ^ (unsigned char)name[i]) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    *length = i;
+    return hash;
+}
+
+/*
+ * Finds every '\n' with memchr(), and cuts the lines that are too long like the reader does.
+ */
+int count_body_lines(const char *body, long length)
+{
+    const char *end;
+    long start = 0, line_length;
+    int count = 0;
+
+    while (start < length)
+    {
+        end = memchr(body + start, '\n', length - start);
+        line_length = end != NULL ? end - (body + start) + 1 : length - start;
+        start += line_length < MAX_LINE_LENGTH - 1 ? line_length : MAX_LINE_LENGTH - 1;
+        count++;
+    }
+
+    return count;
+}
+
+/* Empty the slots of a macro index, the macros themselves are freed with the list */
+void clear_macro_index(macro_index *index)
+{
+    if (index->slots != NULL)
+    {
+        memset(index->slots, 0, sizeof(macro *) * index->capacity);
+    }
+    index->count = 0;
+}
+
+/* Free the slots of a macro index */
+void free_macro_index(macro_index *index)
+{
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
+
 /*
  * Prints an error message corresponding to a given error code.
  */
 void errors_table(ERRORS error_code, int line_counter)
 {
+    diagnostic_line(line_counter);
+
     switch (error_code)
     {
     case FILE_NAME_EXCEED_MAXIMUM:
-        printf("Error: File name exceed the maximum length.\n");
+        diagnostic_printf("Error: File name exceed the maximum length.\n");
         break;
     case ERROR_RESERVED_WORD:
-        printf("Error on line %d: The name used is a reserved word and cannot be used.\n", line_counter);
+        diagnostic_printf("Error on line %d: The name used is a reserved word and cannot be used.\n", line_counter);
         break;
     case ERROR_INVALID_MACRO_NAME:
-        printf("Error on line %d: Invalid macro name.\n", line_counter);
+        diagnostic_printf("Error on line %d: Invalid macro name.\n", line_counter);
         break;
     case ERROR_TEXT_AFTER_MACROEND:
-        printf("Error on line %d: Unexpected text after 'macroend'.\n", line_counter);
+        diagnostic_printf("Error on line %d: Unexpected text after 'macroend'.\n", line_counter);
         break;
     case MISSING_MACRO_NAME:
-        printf("Error on line %d: Missing macro name.\n", line_counter);
+        diagnostic_printf("Error on line %d: Missing macro name.\n", line_counter);
         break;
     case EXCEED_MAXIMUM_MACRO_LENGTH:
-        printf("Error on line %d: Macro name exceed maximum length.\n", line_counter);
+        diagnostic_printf("Error on line %d: Macro name exceed maximum length.\n", line_counter);
         break;
     case MACRO_ALREADY_DEFINED:
-        printf("Error on line %d: Macro name already defined.\n", line_counter);
+        diagnostic_printf("Error on line %d: Macro name already defined.\n", line_counter);
         break;
     case FAILED_TO_REMOVE_FILE:
-        printf("Error: Failed to remove file.\n");
+        diagnostic_printf("Error: Failed to remove file.\n");
         break;
     case FAILED_TO_OPEN_FILE:
-        printf("Error: Failed to open file.\n");
+        diagnostic_printf("Error: Failed to open file.\n");
         break;
     case MALLOC_FAILED:
-        printf("Error: Malloc failed.\n");
+        diagnostic_printf("Error: Malloc failed.\n");
         break;
     case LINE_LENGTH_EXCEED_MAXIMUM:
-        printf("Error on Line %d: line length is over then 80 chars .\n", line_counter);
+        diagnostic_printf("Error on Line %d: line length is over then 80 chars .\n", line_counter);
         break;
     case ERROR_NOTE_WITH_SPACE:
-        printf("Error on line %d: Invalid Note cannot have whitespaces before .\n" , line_counter);
+        diagnostic_printf("Error on line %d: Invalid Note cannot have whitespaces before .\n" , line_counter);
+        break;
+    case TOO_MANY_ERRORS:
+        diagnostic_printf("Error: Too many errors, stopped assembling the file.\n");
+        break;
+    case INCLUDE_INVALID_PATH:
+        diagnostic_printf("Error on line %d: .include needs a file name in quotation marks.\n", line_counter);
+        break;
+    case INCLUDE_FAILED_TO_OPEN:
+        diagnostic_printf("Error on line %d: Failed to open the included file.\n", line_counter);
+        break;
+    case INCLUDE_RECURSIVE:
+        diagnostic_printf("Error on line %d: The included file includes itself.\n", line_counter);
+        break;
+    case INCLUDE_HAS_ERRORS:
+        diagnostic_printf("Error on line %d: The included file has errors.\n", line_counter);
+        break;
+    case INCLUDE_NOT_ALLOWED:
+        diagnostic_printf("Error on line %d: .include can't read files in a source assembled in memory.\n", line_counter);
+        break;
+    case MACRO_INVALID_PARAMETERS:
+        diagnostic_printf("Error on line %d: Invalid macro parameters.\n", line_counter);
+        break;
+    case MACRO_WRONG_ARGUMENTS:
+        diagnostic_printf("Error on line %d: The macro call doesn't match the parameters of the macro.\n", line_counter);
+        break;
+    case MACRO_LINE_TOO_LONG:
+        diagnostic_printf("Error on line %d: A line of the expanded macro is over 80 chars.\n", line_counter);
+        break;
+    case FAILED_TO_WRITE_FILE:
+        diagnostic_printf("Error: Failed to write file.\n");
         break;
 
     }
 }
 
+/*
+ * Checks the error count of the file against the --max-errors limit.
+ */
+bool error_limit_reached(const assembler_table *table)
+{
+    return table->options->max_errors > 0 && table->error_count >= table->options->max_errors;
+}
+
 /*
  * Prints an error message of the first pass corresponding to a given error code.
  */
 void first_pass_errors(FIRST_PASS_ERRORS error_code, int line, int error_counter)
 {
+    diagnostic_line(line);
+
     switch (error_code)
     {
     case ERR_AM_FILE:
-        printf("ERROR: Could not open the .am file\n");
+        diagnostic_printf("ERROR: Could not open the .am file\n");
         break;
 
     case ERR_NOT_COMMAND_OR_DIRECTIVE:
-        printf("ERROR on line %d: Something other than a command or a directive was entered after the label. \n", line);
+        diagnostic_printf("ERROR on line %d: Something other than a command or a directive was entered after the label. \n", line);
         break;
 
     case ERR_FIRST_PASS:
-        printf("First pass failed.\n");
+        diagnostic_printf("First pass failed.\n");
         break;
 
     case ERR_AMOUNT_OF_ERRORS:
-        printf("%d ERRORS has been detected on the first pass.\n", error_counter);
+        diagnostic_printf("%d ERRORS has been detected on the first pass.\n", error_counter);
         break;
 
     case ERR_LABEL_INVALID:
-        printf("ERROR on line %d: The label is invalid / doesn't exist.\n", line);
+        diagnostic_printf("ERROR on line %d: The label is invalid / doesn't exist.\n", line);
         break;
 
     case ERR_UNKNOWN_DIRECTIVE:
-        printf("ERROR on line %d: The directive after label is not known\n", line);
+        diagnostic_printf("ERROR on line %d: The directive after label is not known\n", line);
         break;
 
     case ERR_NOT_A_NUMBER:
-        printf("ERROR on line %d: The argument has to be a number!\n", line);
+        diagnostic_printf("ERROR on line %d: The argument has to be a number!\n", line);
         break;
 
     case ERR_NO_QUOTATION_MARKS:
-        printf("ERROR on line %d: There are no quotation marks straightly after .string\n", line);
+        diagnostic_printf("ERROR on line %d: There are no quotation marks straightly after .string\n", line);
         break;
 
     case ERR_LABEL_IS_NOT_ALPHANUMERIC:
-        printf("ERROR on line %d: The label includes a character other than a digit or a letter.\n", line);
+        diagnostic_printf("ERROR on line %d: The label includes a character other than a digit or a letter.\n", line);
         break;
 
     case ERR_LABEL_ENDING:
-        printf("ERROR on line %d: The label cannot end with a character other than a ':'\n", line);
+        diagnostic_printf("ERROR on line %d: The label cannot end with a character other than a ':'\n", line);
         break;
 
     case ERR_OPCODE:
-        printf("ERROR on line %d: The given opcode is invalid\n", line);
+        diagnostic_printf("ERROR on line %d: The given opcode is invalid\n", line);
         break;
 
     case ERR_LABEL_RESERVED:
-        printf("ERROR on line %d: The label cannot be a reserved word of the assembler.\n", line);
+        diagnostic_printf("ERROR on line %d: The label cannot be a reserved word of the assembler.\n", line);
         break;
 
     case ERR_LABEL_START:
-        printf("ERROR on line %d: The label has to start with a letter.\n", line);
+        diagnostic_printf("ERROR on line %d: The label has to start with a letter.\n", line);
         break;
 
     case ERR_EXTERNAL_LABEL_EXISTS:
-        printf("ERROR on line %d: External label already declared.\n", line);
+        diagnostic_printf("ERROR on line %d: External label already declared.\n", line);
         break;
 
     case ERR_LABEL_EXISTS:
-        printf("ERROR on line %d: The label already exists with the same type.\n", line);
+        diagnostic_printf("ERROR on line %d: The label already exists with the same type.\n", line);
         break;
 
     case ERR_INVALID_MATRIX:
-        printf("ERROR on line %d: The matrix is invalid\n", line);
+        diagnostic_printf("ERROR on line %d: The matrix is invalid\n", line);
         break;
 
     case ERR_INVALID_MAT_ARGUMENT:
-        printf("ERROR on line %d: .mat recieved an invalid argument\n", line);
+        diagnostic_printf("ERROR on line %d: .mat recieved an invalid argument\n", line);
         break;
 
     case ERR_MAT_WRONG_AMOUNT_OF_VALUES:
-        printf("ERROR on line %d: The matrix didn't get the right amount of values\n", line);
+        diagnostic_printf("ERROR on line %d: The matrix didn't get the right amount of values\n", line);
         break;
 
     case ERR_CLOSING_QUOTATION_MARK:
-        printf("ERROR on line %d: Missing closing quotation mark in .string directive\n", line);
+        diagnostic_printf("ERROR on line %d: Missing closing quotation mark in .string directive\n", line);
         break;
 
     case ERR_INVALID_OP:
-        printf("ERROR in line %d: Invalid operator\n", line);
+        diagnostic_printf("ERROR in line %d: Invalid operator\n", line);
         break;
 
     case ERR_INVALID_SRC_OP:
-        printf("ERROR in line %d: Invalid source operand\n", line);
+        diagnostic_printf("ERROR in line %d: Invalid source operand\n", line);
         break;
 
     case ERR_INVALID_DEST_OP:
-        printf("ERROR in line %d: Invalid destination operand\n", line);
+        diagnostic_printf("ERROR in line %d: Invalid destination operand\n", line);
         break;
 
     case ERR_SHOULD_NOT_HAVE_OP:
-        printf("ERROR in line %d: The command should not have operands\n", line);
+        diagnostic_printf("ERROR in line %d: The command should not have operands\n", line);
         break;
 
     case ERR_MISSING_OPERAND:
-        printf("ERROR in line %d: The command is missing its operand\n", line);
+        diagnostic_printf("ERROR in line %d: The command is missing its operand\n", line);
         break;
 
     case ERR_TOO_MANY_OPERANDS:
-        printf("ERROR in line %d: The command has too many operands\n", line);
+        diagnostic_printf("ERROR in line %d: The command has too many operands\n", line);
         break;
 
     case ERR_SHOULD_HAVE_TWO_OP:
-        printf("ERROR in line %d: The command should have two operands\n", line);
+        diagnostic_printf("ERROR in line %d: The command should have two operands\n", line);
         break;
 
     case ERR_MAX_MEMORY:
-        printf("ERROR: The program exceeds the maximum memory limit\n");
+        diagnostic_printf("ERROR: The program exceeds the maximum memory limit\n");
         break;
 
     case ERR_MISSING_BRACKET:
-        printf("ERROR in line %d: There is a missing bracket\n", line);
+        diagnostic_printf("ERROR in line %d: There is a missing bracket\n", line);
         break;
 
     case ERR_DOUBLE_COMMA:
-        printf("ERROR in line %d: There is a double comma\n", line);
+        diagnostic_printf("ERROR in line %d: There is a double comma\n", line);
         break;
 
     default:
-        printf("Error on line %d: Unknown error code.\n", line);
+        diagnostic_printf("Error on line %d: Unknown error code.\n", line);
         break;
     }
 }
@@ -397,6 +480,6 @@ void safe_remove(const char *filename)
     if (remove(filename) != 0)
     {
         errors_table(FAILED_TO_REMOVE_FILE, -1);
-        exit(1);
+        fatal_exit(); /* Exit the program (or give up the file, in the library) */
     }
 }
@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "include_cache.h"
+
+/* Options of an included file: no limit on the errors, a single thread, and only its own macros */
+static assembler_options include_options = {false, false, 0, false, 1, NULL, false};
+
+/* The cached files, newest first, and the lock that protects the list */
+static include_entry *cached_files = NULL;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Takes the older entries of the same file out of the cache. The caller holds the cache lock.
+ * Returns those nobody uses, linked by their next field, and leaves the others to their last user.
+ */
+static include_entry *remove_include_entries(const include_entry *entry)
+{
+    include_entry **link = &cached_files, *old, *unused = NULL;
+
+    while ((old = *link) != NULL)
+    {
+        if (old->device != entry->device || old->inode != entry->inode)
+        {
+            link = &old->next;
+            continue;
+        }
+
+        *link = old->next;
+        old->replaced = true;
+        old->next = NULL;
+        if (old->users == 0)
+        {
+            old->next = unused;
+            unused = old;
+        }
+    }
+
+    return unused;
+}
+
+/*
+ * The lock is not held while a file is preprocessed, since that file may include others.
+ * Two threads may then preprocess the same file at once; the first entry is kept.
+ * A file that changed gets a new entry, which replaces the entries of the same file;
+ * one that another thread is still copying is freed when it is released.
+ */
+const include_entry *get_included_file(const char *path, const include_frame *includer, bool *recursive)
+{
+    struct stat info;
+    include_entry state, *entry, *cached, *replaced = NULL;
+    include_frame frame;
+    const include_frame *outer;
+    FILE *fp;
+
+    *recursive = false;
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode) || strlen(path) >= MAX_LINE_LENGTH)
+    {
+        return NULL;
+    }
+
+    for (outer = includer; outer != NULL; outer = outer->outer)
+    {
+        if (outer->device == info.st_dev && outer->inode == info.st_ino)
+        {
+            *recursive = true;
+            return NULL;
+        }
+    }
+
+    state.device = info.st_dev;
+    state.inode = info.st_ino;
+    state.modified = info.st_mtim.tv_sec;
+    state.modified_nsec = info.st_mtim.tv_nsec;
+    state.size = info.st_size;
+
+    pthread_mutex_lock(&cache_lock);
+    cached = find_include_entry(&state);
+    if (cached != NULL)
+    {
+        cached->users++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (cached != NULL)
+    {
+        return cached;
+    }
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        return NULL;
+    }
+
+    frame.device = info.st_dev;
+    frame.inode = info.st_ino;
+    frame.outer = includer;
+    entry = preprocess_included_file(path, fp, &frame);
+    fclose(fp);
+    entry->device = state.device;
+    entry->inode = state.inode;
+    entry->modified = state.modified;
+    entry->modified_nsec = state.modified_nsec;
+    entry->size = state.size;
+
+    pthread_mutex_lock(&cache_lock);
+    cached = find_include_entry(entry);
+    if (cached == NULL)
+    {
+        replaced = remove_include_entries(entry);
+        entry->next = cached_files;
+        cached_files = entry;
+        cached = entry;
+        entry = NULL;
+    }
+    cached->users++;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (entry != NULL)
+    {
+        free_include_entry(entry);
+    }
+
+    /* Freed out of the lock, like the entry above */
+    while (replaced != NULL)
+    {
+        entry = replaced->next;
+        free_include_entry(replaced);
+        replaced = entry;
+    }
+
+    return cached;
+}
+
+/*
+ * The last user of a replaced entry frees it.
+ */
+void release_included_file(const include_entry *entry)
+{
+    include_entry *released = (include_entry *)entry;
+    bool unused;
+
+    if (released == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    released->users--;
+    unused = released->replaced && released->users == 0;
+    pthread_mutex_unlock(&cache_lock);
+
+    if (unused)
+    {
+        free_include_entry(released);
+    }
+}
+
+/*
+ * The same identity as the frames of included files.
+ */
+bool source_include_frame(const char *path, include_frame *frame)
+{
+    struct stat info;
+
+    if (stat(path, &info) != 0)
+    {
+        return false;
+    }
+
+    frame->device = info.st_dev;
+    frame->inode = info.st_ino;
+    frame->outer = NULL;
+    return true;
+}
+
+/*
+ * Runs pre_proc() on a table of the file's own, reading the opened file like a library buffer,
+ * so no .am file is written. The frame lives only while the file is preprocessed.
+ */
+include_entry *preprocess_included_file(const char *path, FILE *fp, const include_frame *frame)
+{
+    include_entry *entry = my_malloc(sizeof(include_entry));
+    diagnostics_buffer diagnostics;
+    bool recorded;
+
+    strcpy(entry->path, path);
+    entry->table = initialize_assembler_table("");
+    entry->table->options = &include_options;
+    entry->table->source_stream = fp;
+    entry->table->includer = frame;
+    entry->users = 0;
+    entry->replaced = false;
+    entry->next = NULL;
+
+    recorded = begin_recorded_diagnostics(&diagnostics);
+    entry->success = pre_proc(&entry->table);
+    if (recorded)
+    {
+        end_buffered_diagnostics(&diagnostics);
+        free(diagnostics.text);
+    }
+
+    entry->messages = recorded ? diagnostics.records : NULL;
+    entry->table->source_stream = NULL;
+    entry->table->includer = NULL;
+
+    return entry;
+}
+
+/*
+ * Compares the identity and the state of the file.
+ */
+include_entry *find_include_entry(const include_entry *entry)
+{
+    include_entry *cached;
+
+    for (cached = cached_files; cached != NULL; cached = cached->next)
+    {
+        if (cached->device == entry->device && cached->inode == entry->inode &&
+            cached->modified == entry->modified && cached->modified_nsec == entry->modified_nsec &&
+            cached->size == entry->size)
+        {
+            return cached;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Frees the table, the messages and the entry.
+ */
+void free_include_entry(include_entry *entry)
+{
+    free_assembler_table(entry->table);
+    free_diagnostic_records(entry->messages);
+    free(entry);
+}
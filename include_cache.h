@@ -0,0 +1,106 @@
+#ifndef INCLUDE_CACHE_H
+#define INCLUDE_CACHE_H
+
+#include <time.h>
+#include <sys/types.h>
+#include "assembler.h"
+
+/* ============================ Included files ================================== */
+
+/*
+ * '.include "FILE"' pastes the macro expanded lines of FILE into the source,
+ * and defines its macros for the rest of the source. FILE is preprocessed on its own,
+ * so it only sees its own macros (and the files it includes), and the result is kept
+ * in memory, keyed by the device and inode of the file, its modification time and size:
+ * every source of a batch that includes the same file reuses it without reading it again,
+ * whatever the path it was named by or the working directory. Once the file changed,
+ * its new result replaces the old one, so a server or a watcher keeps one per file.
+ * The path is relative to the working directory, without whitespaces.
+ * A file that includes the source or one of the files that include it is an error,
+ * found by walking the include_frame chain, so the result of a file never depends
+ * on who included it.
+ * The messages of an included file with errors are printed with its path before them,
+ * since their line numbers are lines of that file.
+ */
+
+/* A file being preprocessed because another file includes it */
+typedef struct include_frame
+{
+    dev_t device;                       /* Device of the file */
+    ino_t inode;                        /* Inode of the file */
+    const struct include_frame *outer;  /* The frame of the file that includes it, NULL for a source */
+} include_frame;
+
+/* A preprocessed file, kept until the file changes */
+typedef struct include_entry
+{
+    char path[MAX_LINE_LENGTH];       /* The path given to .include the first time */
+    dev_t device;                     /* Device of the file */
+    ino_t inode;                      /* Inode of the file */
+    time_t modified;                  /* Modification time of the file (seconds) */
+    long modified_nsec;               /* Modification time of the file (nanoseconds) */
+    long size;                        /* Size of the file */
+    bool success;                     /* Whether the file was preprocessed without errors */
+    assembler_table *table;           /* Its macros, expanded source and macro calls */
+    diagnostic_record *messages;      /* The messages of its preprocessing */
+    int users;                        /* Number of files using it, see release_included_file() */
+    bool replaced;                    /* Out of the cache, freed by its last user */
+    struct include_entry *next;       /* The next cached file */
+} include_entry;
+
+/**
+ * Returns the preprocessed form of a file, preprocessing it only if it isn't cached yet
+ * or was changed since. Safe to call from several threads.
+ *
+ * @param path The path of the file.
+ * @param includer The frames of the files that include the one including it, NULL for a source.
+ * @param recursive Set to true if the file is one of them (NULL is returned).
+ * @return The cached file, to give back with release_included_file(),
+ *         or NULL if the file can't be opened or is recursive.
+ */
+const include_entry *get_included_file(const char *path, const include_frame *includer, bool *recursive);
+
+/**
+ * Gives back a file returned by get_included_file(). A file that was replaced
+ * in the cache meanwhile is freed by its last user.
+ *
+ * @param entry The cached file, or NULL.
+ */
+void release_included_file(const include_entry *entry);
+
+/**
+ * Gives a source file the first frame of the include chain, so a file it includes
+ * can't include it back.
+ *
+ * @param path The path of the source file.
+ * @param frame Receives the frame, with no outer frame.
+ * @return false if the file can't be found (a stream has no frame).
+ */
+bool source_include_frame(const char *path, include_frame *frame);
+
+/**
+ * Preprocesses a file on its own, keeping its messages.
+ *
+ * @param path The path of the file.
+ * @param fp The opened file.
+ * @param frame The frame of the file while it is preprocessed, or NULL.
+ * @return A new entry, not yet in the cache.
+ */
+include_entry *preprocess_included_file(const char *path, FILE *fp, const include_frame *frame);
+
+/**
+ * Finds the entry of a file with the given state in the cache. The caller holds the cache lock.
+ *
+ * @param entry An entry with the identity and state of the file.
+ * @return The cached entry, or NULL.
+ */
+include_entry *find_include_entry(const include_entry *entry);
+
+/**
+ * Frees an entry that isn't in the cache.
+ *
+ * @param entry The entry.
+ */
+void free_include_entry(include_entry *entry);
+
+#endif
@@ -0,0 +1,18 @@
+MAIN: mov M1[r2][r7],LENGTH 
+.include macro_library.as
+.include ""
+.include "macro_library.as" junk
+.include "missing_file.as"
+; A file that includes itself
+.include "invalid_include.as"
+; A file with errors
+.include "invalid_macro.as"
+; A macro of the source with the name of an included one
+mcro  incdec  
+    inc K 
+mcroend  
+.include "macro_library.as"
+
+K:  .data 22 
+M1:  .mat  [2][2]  1,2,3,4
+LENGTH: .data 6,-9,15 
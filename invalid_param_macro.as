@@ -0,0 +1,41 @@
+MAIN: mov M1[r2][r7],LENGTH 
+; Invalid parameter lists
+mcro  bad1(a, a)  
+    inc %a 
+mcroend  
+mcro  bad2(a,)  
+    inc %a 
+mcroend  
+mcro  bad3(1a)  
+    inc K 
+mcroend  
+mcro  bad4(a, b  
+    inc K 
+mcroend  
+mcro  bad5(a,b,c,d,e,f,g,h,i)  
+    inc K 
+mcroend  
+mcro  bad6(a) junk  
+    inc K 
+mcroend  
+
+mcro  two(first, second)  
+    mov %first,%second 
+mcroend  
+; Calls that don't match the parameters
+two(r1)
+two(r1, r2, r3)
+two(r1, )
+two(r1, r2) junk
+two
+two(r1, r2
+; A line that becomes too long once the argument is in
+mcro  twice(x)  
+    mov %x,%x 
+mcroend  
+twice(XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX)
+two(r1, r2)
+
+K:  .data 22 
+M1:  .mat  [2][2]  1,2,3,4
+LENGTH: .data 6,-9,15 
@@ -0,0 +1,140 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include "jobserver.h"
+
+/*
+ * Parses the last jobserver option of MAKEFLAGS (make adds "--jobserver-auth",
+ * older versions "--jobserver-fds"), and opens the fifo or checks the inherited pipe.
+ */
+void connect_jobserver(jobserver *server)
+{
+    const char *flags = getenv("MAKEFLAGS");
+    const char *option = NULL, *found;
+    char path[MAX_JOBSERVER_PATH];
+    int read_fd, write_fd, length;
+
+    server->active = false;
+    server->read_fd = server->write_fd = -1;
+    server->own_read_fd = false;
+    server->single_job = false;
+
+    if (flags == NULL)
+    {
+        return;
+    }
+
+    for (found = flags; (found = strstr(found, "--jobserver-")) != NULL; found++)
+    {
+        if (strncmp(found, "--jobserver-auth=", strlen("--jobserver-auth=")) == 0 ||
+            strncmp(found, "--jobserver-fds=", strlen("--jobserver-fds=")) == 0)
+        {
+            option = strchr(found, '=') + 1;
+        }
+    }
+
+    if (option == NULL)
+    {
+        return;
+    }
+
+    if (strncmp(option, "fifo:", strlen("fifo:")) == 0)
+    {
+        option += strlen("fifo:");
+        length = strcspn(option, " ");
+        if (length >= MAX_JOBSERVER_PATH)
+        {
+            return;
+        }
+        memcpy(path, option, length);
+        path[length] = '\0';
+
+        /* A descriptor of our own, both ends on it */
+        server->read_fd = open(path, O_RDWR | O_NONBLOCK);
+        if (server->read_fd < 0)
+        {
+            server->single_job = true;
+            return;
+        }
+        server->write_fd = server->read_fd;
+        server->own_read_fd = true;
+        server->active = true;
+        return;
+    }
+
+    /* "R,W": the descriptors are only inherited if the recipe was marked with '+' */
+    if (sscanf(option, "%d,%d", &read_fd, &write_fd) != 2 || read_fd < 0 || write_fd < 0 ||
+        fcntl(read_fd, F_GETFD) == -1 || fcntl(write_fd, F_GETFD) == -1)
+    {
+        return;
+    }
+
+    /* Reading the shared blocking descriptor after poll() could wait forever,
+       if another job takes the token in between */
+    server->read_fd = reopen_nonblocking(read_fd);
+    if (server->read_fd < 0)
+    {
+        server->single_job = true;
+        return;
+    }
+    server->own_read_fd = true;
+    server->write_fd = write_fd;
+    server->active = true;
+}
+
+/*
+ * The pipe is shared with make and the other jobs, so its own flags can't be changed;
+ * opening it again through /proc gives a descriptor whose flags are ours.
+ */
+int reopen_nonblocking(int fd)
+{
+    char path[MAX_LINE_LENGTH];
+
+    sprintf(path, "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY | O_NONBLOCK);
+}
+
+/*
+ * Waits for the jobserver to be readable, then tries to read one byte.
+ * Another process may take the token first, in which case nothing is read.
+ */
+bool take_jobserver_token(jobserver *server, char *token, int timeout_ms)
+{
+    struct pollfd ready;
+
+    ready.fd = server->read_fd;
+    ready.events = POLLIN;
+    ready.revents = 0;
+
+    if (poll(&ready, 1, timeout_ms) <= 0 || !(ready.revents & POLLIN))
+    {
+        return false;
+    }
+
+    return read(server->read_fd, token, 1) == 1;
+}
+
+/*
+ * Writes the token back, retrying after signals.
+ */
+void release_jobserver_token(jobserver *server, char token)
+{
+    while (write(server->write_fd, &token, 1) != 1 && errno == EINTR)
+        ;
+}
+
+/*
+ * Only the descriptors opened here are closed, the inherited ones belong to make.
+ */
+void disconnect_jobserver(jobserver *server)
+{
+    if (server->own_read_fd)
+    {
+        close(server->read_fd);
+    }
+
+    server->active = false;
+}
@@ -0,0 +1,76 @@
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#include "assembler.h"
+
+/* ============================ GNU make jobserver ================================== */
+
+/*
+ * When the assembler is started by "make -jN", make passes a jobserver in MAKEFLAGS
+ * ("--jobserver-auth=fifo:PATH" or "--jobserver-auth=R,W"). Every running job owns
+ * one token: the assembler has one for free, and reads one more byte from the jobserver
+ * for every extra file it assembles at the same time, writing it back when the file is done.
+ * This keeps the threads of "-j" within the parallelism of the whole build.
+ */
+
+/* How long a worker waits for a token before checking that there is still work (milliseconds) */
+#define JOBSERVER_POLL_MS 50
+
+/* Maximum length of the path of a jobserver fifo */
+#define MAX_JOBSERVER_PATH 4096
+
+/* Connection to the jobserver of the parent make */
+typedef struct jobserver
+{
+    bool active;      /* false when there is no (usable) jobserver */
+    int read_fd;      /* Tokens are read from here */
+    int write_fd;     /* and written back here */
+    bool own_read_fd; /* read_fd was opened by the assembler, and is closed with the connection */
+    bool single_job;  /* make has a jobserver that can't be used safely: run one file at a time */
+} jobserver;
+
+/**
+ * Looks for a jobserver in MAKEFLAGS, and connects to it.
+ * Without one (or when make didn't pass the descriptors), the connection stays inactive.
+ * If the jobserver can't be read without blocking, it stays inactive too, with single_job
+ * set: the assembler then keeps to the one job make gave it.
+ *
+ * @param server The connection to set up.
+ */
+void connect_jobserver(jobserver *server);
+
+/**
+ * Waits up to the given time for a token.
+ *
+ * @param server An active connection.
+ * @param token Receives the token byte, which must be given back as is.
+ * @param timeout_ms How long to wait, in milliseconds.
+ * @return true if a token was taken.
+ */
+bool take_jobserver_token(jobserver *server, char *token, int timeout_ms);
+
+/**
+ * Gives a token back to the jobserver.
+ *
+ * @param server An active connection.
+ * @param token The token byte that was taken.
+ */
+void release_jobserver_token(jobserver *server, char token);
+
+/**
+ * Closes the descriptors opened by connect_jobserver().
+ *
+ * @param server The connection.
+ */
+void disconnect_jobserver(jobserver *server);
+
+/**
+ * Opens a descriptor of its own, in non blocking mode, on the read end of an inherited pipe,
+ * so a worker that lost the race for a token doesn't block in read().
+ *
+ * @param fd The inherited descriptor.
+ * @return The new descriptor, or -1 if it can't be opened (Linux only).
+ */
+int reopen_nonblocking(int fd);
+
+#endif /* JOBSERVER_H */
@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "libassembler.h"
+#include "translation_unit.h"
+
+/*
+ * Copies the options; the table itself is created on the first source,
+ * where a failed allocation can be recovered from.
+ */
+assembler_context *create_assembler_context(const assembler_options *options)
+{
+    assembler_context *context = malloc(sizeof(assembler_context));
+
+    if (context == NULL)
+    {
+        return NULL;
+    }
+
+    context->table = NULL;
+    context->options = options != NULL ? *options : default_options;
+
+    /* There are no files to read from or write to */
+    context->options.keep_am = false;
+    context->options.use_stdio = false;
+    context->options.memory_only = true;
+
+    /* A fatal error can only jump back from the thread that set the recovery point */
+    context->options.preprocess_threads = 1;
+
+    return context;
+}
+
+/*
+ * Runs the stages on a memory stream over the source, collecting the messages
+ * in a recording buffer. A fatal error jumps back here, and the file is given up.
+ */
+bool assemble_in_context(assembler_context *context, const char *source, size_t length, assembly_result *result)
+{
+    diagnostics_buffer diagnostics;
+    diagnostic_record *record;
+    FILE *source_stream;
+
+    memset(result, 0, sizeof(assembly_result));
+    result->success = false;
+
+    if (!begin_recorded_diagnostics(&diagnostics))
+    {
+        return false;
+    }
+
+    /* Some C libraries refuse an empty buffer, and a blank line assembles the same */
+    source_stream = length > 0 ? fmemopen((void *)source, length, "r") : fmemopen("\n", 1, "r");
+    if (source_stream == NULL)
+    {
+        end_buffered_diagnostics(&diagnostics);
+        free(diagnostics.text);
+        free_diagnostic_records(diagnostics.records);
+        return false;
+    }
+
+    set_fatal_recovery(&context->recovery);
+
+    if (setjmp(context->recovery) == 0)
+    {
+        if (context->table == NULL)
+        {
+            context->table = initialize_assembler_table("");
+            context->table->options = &context->options;
+        }
+        context->table->source_stream = source_stream;
+
+        if (preprocess_stage(context->table, "") && passes_stage(context->table, ""))
+        {
+            result->success = context->options.check_only || capture_outputs(context->table, result);
+        }
+    }
+    else if (context->table != NULL)
+    {
+        /* The jump skipped the end of pre_proc(), if it was running */
+        abandon_pre_proc(context->table);
+    }
+
+    set_fatal_recovery(NULL);
+
+    /* Keep the table (and its buffers) for the next source */
+    if (context->table != NULL)
+    {
+        reset_assembler_table(context->table, "");
+        context->table->source_stream = NULL;
+    }
+    fclose(source_stream);
+
+    end_buffered_diagnostics(&diagnostics);
+    result->diagnostics_text = diagnostics.text;
+    result->diagnostics_size = diagnostics.size;
+    result->diagnostics = diagnostics.records;
+    for (record = diagnostics.records; record != NULL; record = record->next)
+    {
+        result->diagnostic_count++;
+    }
+
+    return result->success;
+}
+
+/*
+ * Frees the table and the context.
+ */
+void free_assembler_context(assembler_context *context)
+{
+    if (context == NULL)
+    {
+        return;
+    }
+
+    if (context->table != NULL)
+    {
+        free_assembler_table(context->table);
+    }
+    free(context);
+}
+
+/*
+ * One source, one context.
+ */
+bool assemble_buffer(const char *source, size_t length, const assembler_options *options, assembly_result *result)
+{
+    assembler_context *context = create_assembler_context(options);
+    bool success;
+
+    if (context == NULL)
+    {
+        memset(result, 0, sizeof(assembly_result));
+        result->success = false;
+        return false;
+    }
+
+    success = assemble_in_context(context, source, length, result);
+    free_assembler_context(context);
+
+    return success;
+}
+
+/*
+ * Frees every output and message of the result.
+ */
+void free_assembly_result(assembly_result *result)
+{
+    free(result->object);
+    free(result->entries);
+    free(result->externals);
+    free(result->diagnostics_text);
+    free_diagnostic_records(result->diagnostics);
+    memset(result, 0, sizeof(assembly_result));
+    result->success = false;
+}
+
+/*
+ * Same contents as translation_unit() writes, into memory streams.
+ * Like the files, the entries and externals are left out when they are empty.
+ */
+bool capture_outputs(assembler_table *table, assembly_result *result)
+{
+    FILE *stream;
+
+    stream = open_memstream(&result->object, &result->object_size);
+    if (stream == NULL)
+    {
+        return false;
+    }
+    write_object_image(table, stream);
+    fclose(stream);
+
+    if (has_entry_labels(table->label_list))
+    {
+        stream = open_memstream(&result->entries, &result->entries_size);
+        if (stream == NULL)
+        {
+            return false;
+        }
+        write_entry_labels(table->label_list, stream);
+        fclose(stream);
+    }
+
+    if (has_extern_usages(table->external_list))
+    {
+        stream = open_memstream(&result->externals, &result->externals_size);
+        if (stream == NULL)
+        {
+            return false;
+        }
+        write_extern_usages(table->external_list, stream);
+        fclose(stream);
+    }
+
+    return true;
+}
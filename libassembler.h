@@ -0,0 +1,99 @@
+#ifndef LIBASSEMBLER_H
+#define LIBASSEMBLER_H
+
+#include <stddef.h>
+#include <setjmp.h>
+#include "assembler.h"
+
+/* ============================ Library interface ================================== */
+
+/*
+ * libassembler.a runs the assembler on sources held in memory.
+ * The object image, the entries, the externals and the messages come back in memory:
+ * nothing is read from or written to the file system (so ".include" is an error), nothing is printed,
+ * and a fatal error (a failed allocation) fails the call instead of exiting.
+ * All the state of a run is kept in a context, so every thread can assemble
+ * with its own context, and a context can be reused for many sources.
+ */
+
+/* Everything a source produced */
+typedef struct assembly_result
+{
+    bool success;                    /* true if the source was assembled without errors */
+    char *object;                    /* Contents of the .ob file, NULL unless successful */
+    size_t object_size;              /* Length of the object image */
+    char *entries;                   /* Contents of the .ent file, NULL if there are no entries */
+    size_t entries_size;             /* Length of the entries */
+    char *externals;                 /* Contents of the .ext file, NULL if no external label is used */
+    size_t externals_size;           /* Length of the externals */
+    diagnostic_record *diagnostics;  /* The messages one by one, with their lines */
+    int diagnostic_count;            /* Number of messages */
+    char *diagnostics_text;          /* All the messages, as the assembler would print them */
+    size_t diagnostics_size;         /* Length of the messages text */
+} assembly_result;
+
+/* State of the library, reused from one source to the next */
+typedef struct assembler_context
+{
+    assembler_table *table;     /* The table, created on the first source */
+    assembler_options options;  /* Copy of the options the context was created with */
+    jmp_buf recovery;           /* Where a fatal error jumps back to */
+} assembler_context;
+
+/**
+ * Creates a context for assembling sources in memory.
+ *
+ * @param options The options to use (copied), or NULL for the defaults.
+ * @return The context, or NULL if it could not be allocated.
+ */
+assembler_context *create_assembler_context(const assembler_options *options);
+
+/**
+ * Assembles one source with a context. The results are filled even on failure,
+ * and must be released with free_assembly_result().
+ * With check_only, the source is only checked and no output is returned.
+ *
+ * @param context The context.
+ * @param source The assembly source (does not need to be null terminated).
+ * @param length The length of the source in bytes.
+ * @param result Filled with the outputs and the messages.
+ * @return true if the source was assembled successfully, false otherwise.
+ */
+bool assemble_in_context(assembler_context *context, const char *source, size_t length, assembly_result *result);
+
+/**
+ * Releases a context and its table.
+ *
+ * @param context The context, may be NULL.
+ */
+void free_assembler_context(assembler_context *context);
+
+/**
+ * Assembles one source with a temporary context.
+ * Callers that assemble many sources should keep a context instead.
+ *
+ * @param source The assembly source.
+ * @param length The length of the source in bytes.
+ * @param options The options to use, or NULL for the defaults.
+ * @param result Filled with the outputs and the messages.
+ * @return true if the source was assembled successfully, false otherwise.
+ */
+bool assemble_buffer(const char *source, size_t length, const assembler_options *options, assembly_result *result);
+
+/**
+ * Releases the outputs and the messages of a result.
+ *
+ * @param result The result to clear.
+ */
+void free_assembly_result(assembly_result *result);
+
+/**
+ * Writes the object image, the entries and the externals of an assembled table into the result.
+ *
+ * @param table A table that passed both passes.
+ * @param result The result to fill.
+ * @return true if the outputs were written, false if a memory stream could not be opened.
+ */
+bool capture_outputs(assembler_table *table, assembly_result *result);
+
+#endif /* LIBASSEMBLER_H */
@@ -0,0 +1,351 @@
+#include "link.h"
+#include "translation_unit.h"
+
+/*
+ * Assembles every module (reporting all of them, like a batch), then lays them out,
+ * relocates them, resolves the references between them and writes the program.
+ */
+bool link_program(char *output_name, char **files, int file_count)
+{
+    linked_module *modules = my_malloc(sizeof(linked_module) * file_count);
+    int i, code_total = 0, data_total = 0;
+    bool success = true;
+
+    if (strlen(output_name) > MAX_LABEL_LENGTH)
+    {
+        errors_table(FILE_NAME_EXCEED_MAXIMUM, -1);
+        free(modules);
+        return false;
+    }
+
+    for (i = 0; i < file_count; i++)
+    {
+        modules[i].filename = files[i];
+        if (!assemble_module(&modules[i]))
+        {
+            diagnostic_printf("Error processing file: %s\n", files[i]);
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        layout_modules(modules, file_count, &code_total, &data_total);
+
+        /* Same limit as a single file */
+        if (code_total + data_total + 100 > MAX_MEMORY)
+        {
+            first_pass_errors(ERR_MAX_MEMORY, -1, -1);
+            success = false;
+        }
+    }
+
+    if (success)
+    {
+        for (i = 0; i < file_count; i++)
+        {
+            relocate_module(&modules[i]);
+        }
+
+        success = check_duplicate_exports(modules, file_count);
+
+        for (i = 0; i < file_count; i++)
+        {
+            if (!resolve_module_references(modules, file_count, &modules[i]))
+            {
+                success = false;
+            }
+        }
+    }
+
+    if (success && !default_options.check_only)
+    {
+        write_linked_object(output_name, modules, file_count, code_total, data_total);
+        write_linked_entries(output_name, modules, file_count);
+    }
+
+    if (!success)
+    {
+        diagnostic_printf("Error linking program: %s\n", output_name);
+    }
+
+    for (i = 0; i < file_count; i++)
+    {
+        if (modules[i].table != NULL)
+        {
+            free_assembler_table(modules[i].table);
+        }
+    }
+    free(modules);
+
+    return success;
+}
+
+/*
+ * The stages of a normal run, without the output stage and without the final reset,
+ * so the lists stay for the linking.
+ */
+bool assemble_module(linked_module *module)
+{
+    module->table = NULL;
+    module->code_size = module->data_size = 0;
+
+    if (strlen(module->filename) > MAX_LABEL_LENGTH)
+    {
+        errors_table(FILE_NAME_EXCEED_MAXIMUM, -1);
+        return false;
+    }
+
+    module->table = initialize_assembler_table("");
+
+    if (!preprocess_stage(module->table, module->filename) || !passes_stage(module->table, module->filename))
+    {
+        return false;
+    }
+
+    module->code_size = module->table->instruction_counter - 100;
+    module->data_size = module->table->data_counter;
+
+    return true;
+}
+
+/*
+ * Every module's code keeps its order, starting after the code of the modules before it.
+ * The data of a module is addressed from the end of its own code (see add_label_to_table()),
+ * so the data offset moves that point to the module's place in the data of the program.
+ */
+void layout_modules(linked_module *modules, int count, int *code_total, int *data_total)
+{
+    int i, data_position;
+
+    *code_total = *data_total = 0;
+    for (i = 0; i < count; i++)
+    {
+        modules[i].code_offset = *code_total;
+        *code_total += modules[i].code_size;
+    }
+
+    data_position = 100 + *code_total;
+    for (i = 0; i < count; i++)
+    {
+        modules[i].data_base = data_position;
+        modules[i].data_offset = data_position - modules[i].table->instruction_counter;
+        data_position += modules[i].data_size;
+        *data_total += modules[i].data_size;
+    }
+}
+
+/*
+ * The defined labels move first, then every entry takes the address of its label again,
+ * like add_entry_addresses() does in the first pass.
+ */
+void relocate_module(linked_module *module)
+{
+    label *lbl, *defined;
+    command *cmd;
+
+    for (lbl = module->table->label_list; lbl != NULL; lbl = lbl->next)
+    {
+        if (lbl->type == CODE)
+        {
+            lbl->address += module->code_offset;
+        }
+        else if (lbl->type != ENTRY && lbl->type != EXTERNAL)
+        {
+            lbl->address += module->data_offset;
+        }
+    }
+
+    for (lbl = module->table->label_list; lbl != NULL; lbl = lbl->next)
+    {
+        if (lbl->type == ENTRY && (defined = find_defined_label(module->table->label_list, lbl->name)) != NULL)
+        {
+            lbl->address = defined->address;
+        }
+    }
+
+    for (cmd = module->table->code_section; cmd != NULL; cmd = cmd->next)
+    {
+        cmd->address += module->code_offset;
+    }
+}
+
+/*
+ * Inside one program every label is relocatable, so references to other modules
+ * get ARE = R too, and no .ext file is needed.
+ */
+bool resolve_module_references(linked_module *modules, int count, linked_module *module)
+{
+    command *cmd;
+    label *target;
+    bool success = true;
+
+    for (cmd = module->table->code_section; cmd != NULL; cmd = cmd->next)
+    {
+        if (cmd->referenced_label[0] == '\0')
+        {
+            continue;
+        }
+
+        target = find_defined_label(module->table->label_list, cmd->referenced_label);
+        if (target == NULL)
+        {
+            target = find_exported_label(modules, count, cmd->referenced_label);
+        }
+
+        if (target == NULL)
+        {
+            diagnostic_printf("Error: External label '%s' of %s is not an entry of any module.\n",
+                              cmd->referenced_label, module->filename);
+            success = false;
+            continue;
+        }
+
+        cmd->word.value = move_bits(target->address, SHIFT_AFTER_ARE) | R;
+    }
+
+    return success;
+}
+
+/*
+ * Looks for a label the module defines itself.
+ */
+label *find_defined_label(label *list, const char *name)
+{
+    for (; list != NULL; list = list->next)
+    {
+        if (list->type != ENTRY && list->type != EXTERNAL && strcmp(list->name, name) == 0)
+        {
+            return list;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Looks for the .entry label of that name in all the modules.
+ */
+label *find_exported_label(linked_module *modules, int count, const char *name)
+{
+    label *lbl;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        for (lbl = modules[i].table->label_list; lbl != NULL; lbl = lbl->next)
+        {
+            if (lbl->type == ENTRY && strcmp(lbl->name, name) == 0)
+            {
+                return lbl;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Compares the entries of every module with the entries of the modules after it.
+ */
+bool check_duplicate_exports(linked_module *modules, int count)
+{
+    label *entry, *other;
+    int i, j;
+    bool success = true;
+
+    for (i = 0; i < count; i++)
+    {
+        for (entry = modules[i].table->label_list; entry != NULL; entry = entry->next)
+        {
+            if (entry->type != ENTRY)
+            {
+                continue;
+            }
+
+            for (j = i + 1; j < count; j++)
+            {
+                for (other = modules[j].table->label_list; other != NULL; other = other->next)
+                {
+                    if (other->type == ENTRY && strcmp(other->name, entry->name) == 0)
+                    {
+                        diagnostic_printf("Error: Entry label '%s' is defined in both %s and %s.\n",
+                                          entry->name, modules[i].filename, modules[j].filename);
+                        success = false;
+                    }
+                }
+            }
+        }
+    }
+
+    return success;
+}
+
+/*
+ * Same format as object_file(), with the code of all the modules, then all their data.
+ */
+void write_linked_object(char *output_name, linked_module *modules, int count, int code_total, int data_total)
+{
+    char file_object[MAX_LINE_LENGTH] = {0};
+    char ic_dest[MAX_LABEL_LENGTH] = {0};
+    char dc_dest[MAX_LABEL_LENGTH] = {0};
+    char file_external[MAX_LINE_LENGTH] = {0};
+    FILE *fp_ob = NULL;
+    int i;
+
+    if (!open_object_file(output_name, file_object, &fp_ob))
+    {
+        return;
+    }
+
+    translate_ic_dc(code_total, ic_dest);
+    translate_ic_dc(data_total, dc_dest);
+    fprintf(fp_ob, "\t%s\t%s\n", ic_dest, dc_dest);
+
+    for (i = 0; i < count; i++)
+    {
+        write_code_section(modules[i].table->code_section, fp_ob);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        write_data_section(modules[i].table->data_section, modules[i].data_base, fp_ob);
+    }
+
+    fclose(fp_ob);
+
+    /* Every external is resolved, so an .ext file left by an earlier run is stale */
+    add_ending_to_string(file_external, output_name, ".ext");
+    remove(file_external);
+}
+
+/*
+ * Writes the entries of every module to one file, removed again if there are none.
+ */
+void write_linked_entries(char *output_name, linked_module *modules, int count)
+{
+    char file_entry[MAX_LINE_LENGTH] = {0};
+    FILE *fp_ent = NULL;
+    bool written = false;
+    int i;
+
+    if (!open_entry_file(output_name, file_entry, &fp_ent))
+    {
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        if (write_entry_labels(modules[i].table->label_list, fp_ent))
+        {
+            written = true;
+        }
+    }
+
+    fclose(fp_ent);
+
+    if (!written)
+    {
+        safe_remove(file_entry);
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include "assembler.h"
+
+/* ============================ Whole-program mode ================================== */
+
+/*
+ * "--link NAME" assembles all the given files as modules of one program.
+ * Every module goes through the preprocessor and both passes in its own table,
+ * then the modules are laid out one after the other: all the code first,
+ * in the given order, then all the data. The labels are moved to their final
+ * addresses, every .extern reference is resolved to the .entry label of the
+ * module that defines it, and a single NAME.ob (and NAME.ent) is written.
+ * No file of the modules themselves is written, and nothing is parsed twice.
+ */
+
+/* One module of the program */
+typedef struct linked_module
+{
+    char *filename;            /* The file name (without extension) */
+    assembler_table *table;    /* The module's table, kept until the program is written */
+    int code_size;             /* Number of code words */
+    int data_size;             /* Number of data words */
+    int code_offset;           /* Added to the module's code addresses */
+    int data_offset;           /* Added to the module's data addresses */
+    int data_base;             /* Address of the module's first data word in the program */
+} linked_module;
+
+/**
+ * Assembles the files as the modules of one program, and writes the combined output.
+ *
+ * @param output_name The name of the program's output files (without extension).
+ * @param files The modules (without extension).
+ * @param file_count Number of modules.
+ * @return true if every module was assembled and every reference resolved.
+ */
+bool link_program(char *output_name, char **files, int file_count);
+
+/**
+ * Runs the preprocessor and both passes of one module, in a table of its own.
+ *
+ * @param module The module, with its file name set.
+ * @return true if the module has no errors.
+ */
+bool assemble_module(linked_module *module);
+
+/**
+ * Places the modules: the code of all the modules from address 100, then all their data.
+ *
+ * @param modules The assembled modules.
+ * @param count Number of modules.
+ * @param code_total Receives the number of code words of the program.
+ * @param data_total Receives the number of data words of the program.
+ */
+void layout_modules(linked_module *modules, int count, int *code_total, int *data_total);
+
+/**
+ * Moves the labels, entries and words of a module to their addresses in the program.
+ *
+ * @param module The module.
+ */
+void relocate_module(linked_module *module);
+
+/**
+ * Completes the words of a module that reference a label, with the final address
+ * of a label of the module or of the .entry label an .extern refers to.
+ *
+ * @param modules The relocated modules.
+ * @param count Number of modules.
+ * @param module The module whose words are completed.
+ * @return true if every reference was resolved.
+ */
+bool resolve_module_references(linked_module *modules, int count, linked_module *module);
+
+/**
+ * Finds the label a module defines with the given name (not an .entry or .extern one).
+ *
+ * @param list The label list of the module.
+ * @param name The label name.
+ * @return The label, or NULL.
+ */
+label *find_defined_label(label *list, const char *name);
+
+/**
+ * Finds the module that exports a label with .entry, and reports it if more than one does.
+ *
+ * @param modules The modules.
+ * @param count Number of modules.
+ * @param name The label name.
+ * @return The exported label, or NULL.
+ */
+label *find_exported_label(linked_module *modules, int count, const char *name);
+
+/**
+ * Checks that no label is exported by two modules.
+ *
+ * @param modules The modules.
+ * @param count Number of modules.
+ * @return true if every .entry name is unique in the program.
+ */
+bool check_duplicate_exports(linked_module *modules, int count);
+
+/**
+ * Writes the .ob file of the program: the totals, the code of every module, then its data.
+ *
+ * @param output_name The name of the program (without extension).
+ * @param modules The linked modules.
+ * @param count Number of modules.
+ * @param code_total Number of code words.
+ * @param data_total Number of data words.
+ */
+void write_linked_object(char *output_name, linked_module *modules, int count, int code_total, int data_total);
+
+/**
+ * Writes the .ent file of the program, with the entries of all the modules,
+ * or removes it if there are none.
+ *
+ * @param output_name The name of the program (without extension).
+ * @param modules The linked modules.
+ * @param count Number of modules.
+ */
+void write_linked_entries(char *output_name, linked_module *modules, int count);
+
+#endif /* LINK_H */
@@ -0,0 +1,13 @@
+mcro  incdec  
+    inc K 
+    dec K 
+mcroend  
+
+mcro  setr(value, reg)  
+    mov %value,%reg 
+mcroend  
+
+mcro  copy_cell(mat, reg)  
+    mov %mat[r1][r2],%reg 
+    sub %reg,r1 
+mcroend  
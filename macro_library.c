@@ -0,0 +1,370 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include "macro_library.h"
+#include "include_cache.h"
+#include "pre_proc.h"
+
+/* Starting value of a checksum (the FNV-1a offset basis) */
+#define LIBRARY_CHECKSUM_START 2166136261UL
+
+/* Protects the rejected records of every library, since the tables of several threads share them */
+static pthread_mutex_t rejected_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Goes on hashing (FNV-1a) from the given hash, so one checksum can cover several regions.
+ */
+static unsigned long library_checksum(unsigned long hash, const char *text, long length)
+{
+    long i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash = ((hash ^ (unsigned char)text[i]) * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    return hash;
+}
+
+/*
+ * Writes the library to a temporary file next to it, then renames it over the old one.
+ */
+static bool write_macro_library(const char *path, const char *file, long size)
+{
+    char temp_path[MAX_LINE_LENGTH + 16];
+    FILE *fp;
+    int fd;
+    bool written;
+
+    sprintf(temp_path, "%s.XXXXXX", path);
+    fd = mkstemp(temp_path);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    /* mkstemp() creates the file for its owner only */
+    fchmod(fd, 0644);
+    if ((fp = fdopen(fd, "wb")) == NULL)
+    {
+        close(fd);
+        remove(temp_path);
+        return false;
+    }
+
+    written = fwrite(file, 1, size, fp) == (size_t)size;
+    written = fclose(fp) == 0 && written;
+    if (!written || rename(temp_path, path) != 0)
+    {
+        remove(temp_path);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * The file is preprocessed like an included file, then laid out in memory and written at once.
+ * The hash table is filled with linear probing, and is never more than half full.
+ */
+bool compile_macro_library(const char *name)
+{
+    char path[MAX_LINE_LENGTH + 4];
+    include_entry *entry;
+    diagnostic_record *message;
+    macro_library_header *header;
+    library_macro *records;
+    macro_slot *parameter_slots;
+    macro *current;
+    long *slots, count = 0, parameter_slot_count = 0, body_bytes = 0, slot_count = 1, slot, i, size, text_offset;
+    char *file, *bodies;
+    FILE *fp;
+    bool written;
+
+    if (strlen(name) + strlen(".mch") >= MAX_LINE_LENGTH)
+    {
+        errors_table(FILE_NAME_EXCEED_MAXIMUM, -1);
+        return false;
+    }
+
+    add_ending_to_string(path, name, ".as");
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        errors_table(FAILED_TO_OPEN_FILE, -1);
+        return false;
+    }
+    entry = preprocess_included_file(path, fp, NULL);
+    fclose(fp);
+
+    if (!entry->success)
+    {
+        for (message = entry->messages; message != NULL; message = message->next)
+        {
+            diagnostic_line(message->line);
+            diagnostic_printf("%s\n", message->message);
+        }
+        free_include_entry(entry);
+        return false;
+    }
+
+    for (current = entry->table->macro_list; current != NULL; current = current->next)
+    {
+        count++;
+        parameter_slot_count += current->slot_count;
+        body_bytes += current->body_length;
+    }
+    while (slot_count < count * 2)
+    {
+        slot_count *= 2;
+    }
+
+    /* Every part before the bodies is a whole number of longs, so the parameter slots stay aligned */
+    text_offset = sizeof(macro_library_header) + sizeof(library_macro) * count + sizeof(long) * slot_count;
+    size = text_offset + sizeof(macro_slot) * parameter_slot_count + body_bytes;
+    file = my_malloc(size);
+    memset(file, 0, size);
+
+    header = (macro_library_header *)file;
+    records = (library_macro *)(file + sizeof(macro_library_header));
+    slots = (long *)(file + sizeof(macro_library_header) + sizeof(library_macro) * count);
+    parameter_slots = (macro_slot *)(file + text_offset);
+    bodies = (char *)(parameter_slots + parameter_slot_count);
+
+    for (current = entry->table->macro_list, i = 0; current != NULL; current = current->next, i++)
+    {
+        strcpy(records[i].macro_name, current->macro_name);
+        records[i].hash = current->hash;
+        records[i].body = bodies - file;
+        records[i].body_length = current->body_length;
+        records[i].line_count = current->line_count;
+        records[i].parameter_count = current->parameter_count;
+        records[i].parameter_slots = (char *)parameter_slots - file;
+        records[i].parameter_slot_count = current->slot_count;
+
+        memcpy(bodies, current->body, current->body_length);
+        records[i].checksum = library_checksum(library_checksum(LIBRARY_CHECKSUM_START, bodies, current->body_length),
+                                               (const char *)current->slots, sizeof(macro_slot) * current->slot_count);
+        if (current->slot_count > 0)
+        {
+            memcpy(parameter_slots, current->slots, sizeof(macro_slot) * current->slot_count);
+        }
+        bodies += current->body_length;
+        parameter_slots += current->slot_count;
+
+        for (slot = current->hash & (slot_count - 1); slots[slot] != 0; slot = (slot + 1) & (slot_count - 1))
+            ;
+        slots[slot] = i + 1;
+    }
+
+    memcpy(header->magic, MACRO_LIBRARY_MAGIC, sizeof(header->magic));
+    header->header_size = sizeof(macro_library_header);
+    header->record_size = sizeof(library_macro);
+    header->size = size;
+    header->macro_count = count;
+    header->slot_count = slot_count;
+    header->records = sizeof(macro_library_header);
+    header->slots = (char *)slots - file;
+    header->text = text_offset;
+    header->checksum = library_checksum(LIBRARY_CHECKSUM_START, file + sizeof(macro_library_header),
+                                        size - sizeof(macro_library_header));
+
+    add_ending_to_string(path, name, ".mch");
+    written = write_macro_library(path, file, size);
+    if (!written)
+    {
+        errors_table(FAILED_TO_OPEN_FILE, -1);
+    }
+
+    free(file);
+    free_include_entry(entry);
+    return written;
+}
+
+/*
+ * Only the header is read here; the pages of the records and bodies
+ * are read when a file first uses a macro on them.
+ */
+macro_library *open_macro_library(const char *path)
+{
+    struct stat info;
+    macro_library *library;
+    const macro_library_header *header;
+    void *mapping;
+    FILE *fp;
+
+    if (strlen(path) >= MAX_LINE_LENGTH || (fp = fopen(path, "rb")) == NULL)
+    {
+        return NULL;
+    }
+    if (fstat(fileno(fp), &info) != 0 || !S_ISREG(info.st_mode) || info.st_size < (long)sizeof(macro_library_header))
+    {
+        fclose(fp);
+        return NULL;
+    }
+
+    mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    fclose(fp);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    /* The regions must follow each other in the file, in the order they are written */
+    header = mapping;
+    if (memcmp(header->magic, MACRO_LIBRARY_MAGIC, sizeof(header->magic)) != 0 ||
+        header->header_size != sizeof(macro_library_header) || header->record_size != sizeof(library_macro) ||
+        header->size != info.st_size || header->macro_count < 0 ||
+        header->slot_count < 1 || (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->slot_count < header->macro_count * 2 ||
+        header->records != sizeof(macro_library_header) ||
+        header->slots != header->records + (long)sizeof(library_macro) * header->macro_count ||
+        header->text != header->slots + (long)sizeof(long) * header->slot_count || header->text > header->size)
+    {
+        munmap(mapping, info.st_size);
+        return NULL;
+    }
+
+    library = my_malloc(sizeof(macro_library));
+    library->base = mapping;
+    library->header = header;
+    library->records = (const library_macro *)(library->base + header->records);
+    library->slots = (const long *)(library->base + header->slots);
+    strcpy(library->path, path);
+    library->rejected = my_malloc(sizeof(bool) * (header->macro_count > 0 ? header->macro_count : 1));
+    memset(library->rejected, 0, sizeof(bool) * (header->macro_count > 0 ? header->macro_count : 1));
+
+    return library;
+}
+
+/*
+ * The size to unmap is in the header.
+ */
+void close_macro_library(macro_library *library)
+{
+    if (library == NULL)
+    {
+        return;
+    }
+
+    munmap((void *)library->base, library->header->size);
+    free(library->rejected);
+    free(library);
+}
+
+/*
+ * Probes like find_macro(). A slot out of range ends the search, as if it was empty.
+ */
+const library_macro *find_library_macro(const macro_library *library, const char *name)
+{
+    size_t length;
+    unsigned long hash = hash_macro_name(name, &length);
+    long slot, mask = library->header->slot_count - 1, probes;
+    const library_macro *candidate;
+
+    for (slot = hash & mask, probes = 0; probes < library->header->slot_count; slot = (slot + 1) & mask, probes++)
+    {
+        if (library->slots[slot] < 1 || library->slots[slot] > library->header->macro_count)
+        {
+            return NULL;
+        }
+
+        candidate = &library->records[library->slots[slot] - 1];
+        if (candidate->hash == hash && strncmp(candidate->macro_name, name, length) == 0 &&
+            length < MAX_LINE_LENGTH && candidate->macro_name[length] == '\0')
+        {
+            return candidate;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * A refused record is marked in the library, so the next files don't check it again.
+ */
+static macro *reject_library_macro(const macro_library *library, const library_macro *record)
+{
+    pthread_mutex_lock(&rejected_lock);
+    library->rejected[record - library->records] = true;
+    pthread_mutex_unlock(&rejected_lock);
+
+    return NULL;
+}
+
+/*
+ * The node points into the mapping, which outlives every table of the run.
+ * The record is checked once here, since the first pass trusts the line count
+ * and filling the slots trusts them.
+ */
+macro *add_library_macro(assembler_table *assembler, const library_macro *record)
+{
+    const macro_library *library = assembler->options->macro_library;
+    long size = library->header->size, i, end = 0;
+    const macro_slot *slots = (const macro_slot *)(library->base + record->parameter_slots);
+    macro *node;
+
+    if (library_macro_rejected(library, record))
+    {
+        return NULL;
+    }
+
+    if (record->body < library->header->text || record->body_length < 0 || record->body > size - record->body_length ||
+        memchr(record->macro_name, '\0', MAX_LINE_LENGTH) == NULL ||
+        record->parameter_count < 0 || record->parameter_count > MAX_MACRO_PARAMETERS ||
+        record->parameter_slots < library->header->text || record->parameter_slots % sizeof(long) != 0 ||
+        record->parameter_slot_count < 0 ||
+        record->parameter_slot_count > (size - record->parameter_slots) / (long)sizeof(macro_slot))
+    {
+        return reject_library_macro(library, record);
+    }
+
+    if (record->line_count != count_body_lines(library->base + record->body, record->body_length) ||
+        record->checksum != library_checksum(library_checksum(LIBRARY_CHECKSUM_START, library->base + record->body, record->body_length),
+                                             (const char *)slots, sizeof(macro_slot) * record->parameter_slot_count))
+    {
+        return reject_library_macro(library, record);
+    }
+
+    for (i = 0; i < record->parameter_slot_count; end = slots[i].offset + slots[i].length, i++)
+    {
+        if (slots[i].offset < end || slots[i].length < 0 || slots[i].offset > record->body_length - slots[i].length ||
+            slots[i].parameter < 0 || slots[i].parameter >= record->parameter_count)
+        {
+            return reject_library_macro(library, record);
+        }
+    }
+
+    node = arena_alloc(&assembler->macro_storage, sizeof(macro));
+    strcpy(node->macro_name, record->macro_name);
+    node->hash = record->hash;
+    node->body = (char *)library->base + record->body;
+    node->body_length = record->body_length;
+    node->line_count = record->line_count;
+    node->compiled = NULL;
+    node->defined_line = 0;
+    node->parameter_count = record->parameter_count;
+    node->slots = (macro_slot *)slots;
+    node->slot_count = record->parameter_slot_count;
+    node->next = NULL;
+
+    add_to_macro_index(&assembler->library_macros, node);
+    return node;
+}
+
+/*
+ * Read under the lock, like it is written.
+ */
+bool library_macro_rejected(const macro_library *library, const library_macro *record)
+{
+    bool rejected;
+
+    pthread_mutex_lock(&rejected_lock);
+    rejected = library->rejected[record - library->records];
+    pthread_mutex_unlock(&rejected_lock);
+
+    return rejected;
+}
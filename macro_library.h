@@ -0,0 +1,127 @@
+#ifndef MACRO_LIBRARY_H
+#define MACRO_LIBRARY_H
+
+#include "assembler.h"
+
+/* ============================ Macro libraries ================================== */
+
+/*
+ * A macro library is a source of macro definitions compiled once ("--compile-macros NAME"
+ * turns NAME.as into NAME.mch) and mapped read-only by every later run ("--macros FILE").
+ * The file holds a ready hash table over fixed size records, the slots of the parameters
+ * and the bodies one after the other, so loading it reads only the header, whatever
+ * the size of the library:
+ *
+ *     header | records | hash slots | parameter slots | bodies
+ *
+ * Every file starts with the macros of the library, as if they were defined before
+ * its first line: a file can't define a macro of the same name. A macro of the library
+ * gets a node in the table of a file (pointing into the mapping) the first time the file
+ * calls it, since the first pass keeps what it compiles in the node.
+ * The numbers are stored the way this build lays them out, and a file made by
+ * a build with other sizes is refused. Every record has the checksum of its body and
+ * parameter slots, checked with its line count when a file first calls the macro,
+ * so a damaged record is refused without reading the rest of the library.
+ * A refused record is remembered for the whole run, and every call of it is an error.
+ * The library is written to a temporary file renamed over NAME.mch, so a run that
+ * has the old file mapped keeps reading it whole.
+ */
+
+/* First bytes of a macro library file, the last one is the version of the format */
+#define MACRO_LIBRARY_MAGIC "MCHLIB4"
+
+/* Start of a macro library file. The offsets are from the start of the file */
+typedef struct macro_library_header
+{
+    char magic[8];          /* MACRO_LIBRARY_MAGIC */
+    long header_size;       /* sizeof(macro_library_header) of the build that wrote it */
+    long record_size;       /* sizeof(library_macro) of the build that wrote it */
+    long size;              /* Size of the whole file */
+    unsigned long checksum; /* FNV-1a hash of everything after the header, part of the --cache key */
+    long macro_count;       /* Number of records */
+    long slot_count;        /* Number of slots of the hash table (a power of two) */
+    long records;           /* Offset of the records */
+    long slots;             /* Offset of the slots: a record index + 1, or 0 for an empty slot */
+    long text;              /* Offset of the parameter slots, then the bodies */
+} macro_library_header;
+
+/* A macro of the library */
+typedef struct library_macro
+{
+    char macro_name[MAX_LINE_LENGTH]; /* Macro name */
+    unsigned long hash;               /* Hash of the name (see hash_macro_name()) */
+    long body;                        /* Offset of the body in the file */
+    long body_length;                 /* Number of bytes of the body */
+    long line_count;                  /* Number of lines of the body */
+    long parameter_count;             /* Number of parameters */
+    long parameter_slots;             /* Offset of its macro_slot array in the file */
+    long parameter_slot_count;        /* Number of slots */
+    unsigned long checksum;           /* FNV-1a hash of the body, then of the parameter slots */
+} library_macro;
+
+/* A mapped macro library, shared read-only by every table of the run */
+typedef struct macro_library
+{
+    const char *base;                   /* The mapping */
+    const macro_library_header *header; /* The header, at the start of the mapping */
+    const library_macro *records;       /* The records */
+    const long *slots;                  /* The hash table */
+    char path[MAX_LINE_LENGTH];         /* The path it was opened with, for the messages */
+    bool *rejected;                     /* For every record, whether it was refused (see library_macro_rejected()) */
+} macro_library;
+
+/**
+ * Preprocesses NAME.as on its own and writes its macros to NAME.mch.
+ * Only the macros are kept; the messages of the file are printed if it has errors.
+ *
+ * @param name The file name (without extension).
+ * @return true if the library was written.
+ */
+bool compile_macro_library(const char *name);
+
+/**
+ * Maps a macro library and checks its header.
+ *
+ * @param path The path of the .mch file.
+ * @return The library, or NULL if the file can't be mapped or isn't a library of this build.
+ */
+macro_library *open_macro_library(const char *path);
+
+/**
+ * Unmaps a macro library.
+ *
+ * @param library The library, may be NULL.
+ */
+void close_macro_library(macro_library *library);
+
+/**
+ * Looks up a macro in the hash table of the library.
+ * The name ends at a '\n', a '(' or the end of the string, like for find_macro().
+ *
+ * @param library The library.
+ * @param name The name, or a line that may be a macro call.
+ * @return The record, or NULL if the library has no such macro.
+ */
+const library_macro *find_library_macro(const macro_library *library, const char *name);
+
+/**
+ * Gives a macro of the library a node in the table of a file, without copying its body,
+ * and adds it to the library_macros index of the table.
+ *
+ * @param assembler The table of the file.
+ * @param record The record, found with find_library_macro().
+ * @return The node, or NULL if the record points outside the file or doesn't match its body
+ *         (then and afterwards, see library_macro_rejected()).
+ */
+macro *add_library_macro(assembler_table *assembler, const library_macro *record);
+
+/**
+ * Tells whether add_library_macro() refused a record.
+ *
+ * @param library The library.
+ * @param record The record, found with find_library_macro().
+ * @return true if the record was found damaged.
+ */
+bool library_macro_rejected(const macro_library *library, const library_macro *record);
+
+#endif
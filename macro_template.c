@@ -0,0 +1,213 @@
+#include "macro_template.h"
+
+/*
+ * Length of the name at the start of the text: a letter or '_', then letters, digits or '_'.
+ */
+static long name_length(const char *text)
+{
+    long i;
+
+    if (!(isalpha((unsigned char)text[0]) || text[0] == '_'))
+    {
+        return 0;
+    }
+    for (i = 1; isalnum((unsigned char)text[i]) || text[i] == '_'; i++)
+        ;
+
+    return i;
+}
+
+/*
+ * Checks that the list ends with the ')' at the end of the line.
+ */
+static bool list_closed(const char *close)
+{
+    return close != NULL && (close[1] == '\0' || strcmp(close + 1, "\n") == 0);
+}
+
+/*
+ * "()" has no parameters. Every name must be followed by ',' or by the closing ')'.
+ */
+bool split_macro_parameters(const char *text, char names[MAX_MACRO_PARAMETERS][MAX_LINE_LENGTH], int *count)
+{
+    const char *close = strchr(text, ')');
+    long length;
+    int i;
+
+    *count = 0;
+    if (text[0] != '(' || !list_closed(close) || memchr(text + 1, '(', close - text - 1) != NULL)
+    {
+        return false;
+    }
+    if (close == text + 1)
+    {
+        return true;
+    }
+
+    for (text++; text <= close; text += length + 1)
+    {
+        length = name_length(text);
+        if (length == 0 || length > MAX_LABEL_LENGTH || (text[length] != ',' && text + length != close) ||
+            *count == MAX_MACRO_PARAMETERS)
+        {
+            return false;
+        }
+
+        memcpy(names[*count], text, length);
+        names[*count][length] = '\0';
+        for (i = 0; i < *count; i++)
+        {
+            if (strcmp(names[i], names[*count]) == 0)
+            {
+                return false;
+            }
+        }
+        (*count)++;
+    }
+
+    return true;
+}
+
+/*
+ * An argument is anything up to the next ',' or the closing ')', but not empty.
+ */
+bool split_macro_arguments(const char *text, macro_argument arguments[MAX_MACRO_PARAMETERS], int *count)
+{
+    const char *close = strchr(text, ')'), *end;
+
+    *count = 0;
+    if (text[0] != '(')
+    {
+        return text[0] == '\0' || strcmp(text, "\n") == 0;
+    }
+    if (!list_closed(close) || memchr(text + 1, '(', close - text - 1) != NULL)
+    {
+        return false;
+    }
+    if (close == text + 1)
+    {
+        return true;
+    }
+
+    for (text++; text <= close; text = end + 1)
+    {
+        end = memchr(text, ',', close - text);
+        end = end != NULL ? end : close;
+        if (end == text || *count == MAX_MACRO_PARAMETERS)
+        {
+            return false;
+        }
+
+        arguments[*count].text = text;
+        arguments[*count].length = end - text;
+        (*count)++;
+    }
+
+    return true;
+}
+
+/*
+ * Two scans of the body: one counts the references, to allocate the slots at once,
+ * and the other fills them.
+ */
+void compile_macro_template(assembler_table *assembler, macro *template, char names[MAX_MACRO_PARAMETERS][MAX_LINE_LENGTH], int count)
+{
+    long i, length;
+    int parameter, pass, slots = 0;
+
+    template->parameter_count = count;
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1)
+        {
+            template->slots = slots > 0 ? arena_alloc(&assembler->macro_storage, sizeof(macro_slot) * slots) : NULL;
+            template->slot_count = slots;
+            slots = 0;
+        }
+
+        for (i = 0; i < template->body_length; i++)
+        {
+            if (template->body[i] != MACRO_PARAMETER_SIGN)
+            {
+                continue;
+            }
+
+            /* The body isn't null terminated, so the name is measured up to its end */
+            for (length = 0; i + 1 + length < template->body_length &&
+                             (isalnum((unsigned char)template->body[i + 1 + length]) || template->body[i + 1 + length] == '_');
+                 length++)
+                ;
+
+            for (parameter = 0; parameter < count; parameter++)
+            {
+                if ((long)strlen(names[parameter]) == length && strncmp(names[parameter], template->body + i + 1, length) == 0)
+                {
+                    break;
+                }
+            }
+            if (parameter == count)
+            {
+                continue;
+            }
+
+            if (pass == 1)
+            {
+                template->slots[slots].offset = i;
+                template->slots[slots].length = length + 1;
+                template->slots[slots].parameter = parameter;
+            }
+            slots++;
+            i += length;
+        }
+    }
+}
+
+/*
+ * The slots are offsets in the body, so they fit a copy of it.
+ */
+void copy_macro_template(assembler_table *assembler, macro *target, const macro *source)
+{
+    target->parameter_count = source->parameter_count;
+    target->slot_count = source->slot_count;
+    target->slots = NULL;
+
+    if (source->slot_count > 0)
+    {
+        target->slots = arena_alloc(&assembler->macro_storage, sizeof(macro_slot) * source->slot_count);
+        memcpy(target->slots, source->slots, sizeof(macro_slot) * source->slot_count);
+    }
+}
+
+/*
+ * The text between the slots, then an argument, for every slot. The lines are counted
+ * the way the first pass reads them: a line longer than MAX_LINE_LENGTH - 1 would be split.
+ */
+bool fill_macro_template(const macro *template, const macro_argument *arguments, text_buffer *output, long *lines)
+{
+    long position = 0, start = output->length, line_start, i;
+    bool fits = true;
+    int slot;
+
+    for (slot = 0; slot < template->slot_count; slot++)
+    {
+        append_to_text_buffer(output, template->body + position, template->slots[slot].offset - position);
+        append_to_text_buffer(output, arguments[template->slots[slot].parameter].text,
+                              arguments[template->slots[slot].parameter].length);
+        position = template->slots[slot].offset + template->slots[slot].length;
+    }
+    append_to_text_buffer(output, template->body + position, template->body_length - position);
+
+    *lines = 0;
+    for (i = start, line_start = start; i < output->length; i++)
+    {
+        if (output->text[i] == '\n' || i == output->length - 1)
+        {
+            fits = fits && i - line_start + 1 <= MAX_LINE_LENGTH - 1;
+            (*lines)++;
+            line_start = i + 1;
+        }
+    }
+
+    return fits;
+}
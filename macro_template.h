@@ -0,0 +1,78 @@
+#ifndef MACRO_TEMPLATE_H
+#define MACRO_TEMPLATE_H
+
+#include "assembler.h"
+
+/* ============================ Parameterized macros ================================== */
+
+/*
+ * "mcro name(a, b)" defines a macro with parameters, and "%a" in its body refers to one.
+ * The body is compiled once, when the macro is defined, into slots: where every
+ * reference to a parameter is, and which parameter it is. A call "name(r1, #5)"
+ * is then found by its name like any macro call, and expanded by copying the text
+ * between the slots and the arguments into them, without looking at the body again.
+ * A "%" that isn't followed by the name of a parameter is left as it is.
+ * Every expansion has its own text, so the first pass checks the lines of each one,
+ * instead of reusing what it compiled like it does for the other macros.
+ */
+
+/* An argument of a macro call, in the line of the call */
+typedef struct macro_argument
+{
+    const char *text; /* Its first character */
+    long length;      /* Number of characters */
+} macro_argument;
+
+/**
+ * Reads the parameters of a macro definition: names separated by commas,
+ * in parentheses at the end of the cleaned line.
+ *
+ * @param text The cleaned line from the '('.
+ * @param names Receives the names.
+ * @param count Receives the number of parameters.
+ * @return true if the list is closed, with at most MAX_MACRO_PARAMETERS different valid names.
+ */
+bool split_macro_parameters(const char *text, char names[MAX_MACRO_PARAMETERS][MAX_LINE_LENGTH], int *count);
+
+/**
+ * Reads the arguments of a macro call, which point into the line.
+ *
+ * @param text The cleaned line after the name: the '(' of the arguments, or the end of the line.
+ * @param arguments Receives the arguments.
+ * @param count Receives the number of arguments (0 for a call without parentheses).
+ * @return true if the list is closed, with at most MAX_MACRO_PARAMETERS arguments, none of them empty.
+ */
+bool split_macro_arguments(const char *text, macro_argument arguments[MAX_MACRO_PARAMETERS], int *count);
+
+/**
+ * Finds the references to the parameters in the body of a macro, and keeps them
+ * as its slots, allocated from the macro arena of the table.
+ *
+ * @param assembler The table of the file.
+ * @param template The macro, already in the macro list.
+ * @param names The names of its parameters.
+ * @param count Number of parameters.
+ */
+void compile_macro_template(assembler_table *assembler, macro *template, char names[MAX_MACRO_PARAMETERS][MAX_LINE_LENGTH], int count);
+
+/**
+ * Gives a macro the parameters and slots of another one, with the same body.
+ *
+ * @param assembler The table of the macro.
+ * @param target The macro.
+ * @param source The macro to copy from.
+ */
+void copy_macro_template(assembler_table *assembler, macro *target, const macro *source);
+
+/**
+ * Appends the body of a parameterized macro with the arguments in its slots.
+ *
+ * @param template The macro.
+ * @param arguments One argument per parameter.
+ * @param output The buffer to append to.
+ * @param lines Receives the number of lines appended.
+ * @return false if a line came out longer than a line of the source (the text is appended anyway).
+ */
+bool fill_macro_template(const macro *template, const macro_argument *arguments, text_buffer *output, long *lines);
+
+#endif
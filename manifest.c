@@ -0,0 +1,109 @@
+#include "manifest.h"
+
+/*
+ * Opens the manifest file, or stdin for "-".
+ */
+FILE *open_manifest(const char *path)
+{
+    FILE *manifest;
+
+    if (strcmp(path, "-") == 0)
+    {
+        return stdin;
+    }
+
+    manifest = fopen(path, "r");
+    if (manifest == NULL)
+    {
+        printf("Error: Failed to open manifest: %s\n", path);
+    }
+
+    return manifest;
+}
+
+/*
+ * Returns the next non empty, non comment line, trimmed.
+ * A line longer than the buffer is cut, and the rest of it is skipped.
+ */
+bool next_manifest_entry(FILE *manifest, char entry[MAX_MANIFEST_LINE])
+{
+    char line[MAX_MANIFEST_LINE];
+    size_t start, end;
+    int ch;
+
+    while (fgets(line, sizeof(line), manifest) != NULL)
+    {
+        end = strlen(line);
+
+        /* Skips the rest of a line that didn't fit */
+        if (end == sizeof(line) - 1 && line[end - 1] != '\n')
+        {
+            while ((ch = fgetc(manifest)) != '\n' && ch != EOF)
+                ;
+        }
+
+        /* Trims white space from both ends */
+        for (start = 0; isspace((unsigned char)line[start]); start++)
+            ;
+        while (end > start && isspace((unsigned char)line[end - 1]))
+        {
+            end--;
+        }
+
+        if (end == start || line[start] == '#')
+        {
+            continue;
+        }
+
+        memcpy(entry, line + start, end - start);
+        entry[end - start] = '\0';
+        return true;
+    }
+
+    return false;
+}
+
+/*
+ * Closes the manifest, unless it is stdin.
+ */
+void close_manifest(FILE *manifest)
+{
+    if (manifest != stdin)
+    {
+        fclose(manifest);
+    }
+}
+
+/*
+ * Appends every entry of the manifest to the list, doubling it when it is full.
+ */
+bool read_whole_manifest(const char *path, char ***files, int *file_count, int *capacity)
+{
+    char entry[MAX_MANIFEST_LINE];
+    char **grown;
+    FILE *manifest = open_manifest(path);
+
+    if (manifest == NULL)
+    {
+        return false;
+    }
+
+    while (next_manifest_entry(manifest, entry))
+    {
+        if (*file_count == *capacity)
+        {
+            *capacity *= 2;
+            grown = my_malloc(sizeof(char *) * *capacity);
+            memcpy(grown, *files, sizeof(char *) * *file_count);
+            free(*files);
+            *files = grown;
+        }
+
+        (*files)[*file_count] = my_malloc(strlen(entry) + 1);
+        strcpy((*files)[*file_count], entry);
+        (*file_count)++;
+    }
+
+    close_manifest(manifest);
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdio.h>
+#include "assembler.h"
+
+/* ============================ Manifest input ================================== */
+
+/*
+ * A manifest (given as "@FILE" or "--manifest FILE") lists the files to assemble,
+ * one per line, without extension. Blank lines and lines starting with '#' are skipped.
+ * "-" reads the manifest from stdin, so a generator can pipe the names in.
+ * Entries are returned one at a time, so assembly can start before the whole list is read.
+ */
+
+/* Maximum length of a manifest line */
+#define MAX_MANIFEST_LINE 4096
+
+/**
+ * Opens a manifest for reading.
+ *
+ * @param path The manifest path, or "-" for stdin.
+ * @return The opened stream, or NULL (an error is printed) if it can't be opened.
+ */
+FILE *open_manifest(const char *path);
+
+/**
+ * Reads the next file name of a manifest.
+ *
+ * @param manifest The opened manifest.
+ * @param entry Output: the file name, without surrounding white space.
+ * @return true if a name was read, false at the end of the manifest.
+ */
+bool next_manifest_entry(FILE *manifest, char entry[MAX_MANIFEST_LINE]);
+
+/**
+ * Closes a manifest opened with open_manifest().
+ *
+ * @param manifest The manifest.
+ */
+void close_manifest(FILE *manifest);
+
+/**
+ * Reads all the entries of a manifest and appends them to a growing list of files.
+ * Used by the modes that need the full list up front (--watch, --connect).
+ *
+ * @param path The manifest path.
+ * @param files Pointer to the file list (reallocated as needed, entries are allocated copies).
+ * @param file_count Pointer to the number of files in the list.
+ * @param capacity Pointer to the allocated size of the list.
+ * @return false if the manifest could not be opened.
+ */
+bool read_whole_manifest(const char *path, char ***files, int *file_count, int *capacity);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,314 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pipeline.h"
+
+/*
+ * Sets up the three queues and starts one thread per stage.
+ * If a thread can't be started, the queues are closed while they are still empty,
+ * so the stages that did start stop right away, and everything is released.
+ */
+bool start_pipeline(pipeline *line)
+{
+    bool preprocess_started, passes_started, output_started;
+
+    init_stage_queue(&line->to_preprocess);
+    init_stage_queue(&line->to_passes);
+    init_stage_queue(&line->to_output);
+    line->all_success = true;
+
+    preprocess_started = pthread_create(&line->preprocess_thread, NULL, preprocess_worker, line) == 0;
+    passes_started = pthread_create(&line->passes_thread, NULL, passes_worker, line) == 0;
+    output_started = pthread_create(&line->output_thread, NULL, output_worker, line) == 0;
+
+    if (preprocess_started && passes_started && output_started)
+    {
+        return true;
+    }
+
+    close_stage_queue(&line->to_preprocess);
+    close_stage_queue(&line->to_passes);
+    close_stage_queue(&line->to_output);
+
+    if (preprocess_started)
+    {
+        pthread_join(line->preprocess_thread, NULL);
+    }
+    if (passes_started)
+    {
+        pthread_join(line->passes_thread, NULL);
+    }
+    if (output_started)
+    {
+        pthread_join(line->output_thread, NULL);
+    }
+
+    destroy_stage_queue(&line->to_preprocess);
+    destroy_stage_queue(&line->to_passes);
+    destroy_stage_queue(&line->to_output);
+
+    return false;
+}
+
+/*
+ * Wraps the file name in a new item and hands it to the first stage.
+ */
+void submit_to_pipeline(pipeline *line, const char *filename)
+{
+    pipeline_item *item = my_malloc(sizeof(pipeline_item));
+
+    item->filename = my_malloc(strlen(filename) + 1);
+    strcpy(item->filename, filename);
+    item->assembler = NULL;
+    item->success = true;
+    item->finished = false;
+    item->buffered = false;
+    item->cached = false;
+
+    /* The source is read while the files before it go through the preprocessor */
+    prefetch_source_file(filename);
+
+    push_stage_item(&line->to_preprocess, item);
+}
+
+/*
+ * Closing the first queue drains the stages one after the other:
+ * every stage closes the next queue when its own input is closed and empty.
+ */
+bool finish_pipeline(pipeline *line)
+{
+    close_stage_queue(&line->to_preprocess);
+
+    pthread_join(line->preprocess_thread, NULL);
+    pthread_join(line->passes_thread, NULL);
+    pthread_join(line->output_thread, NULL);
+
+    destroy_stage_queue(&line->to_preprocess);
+    destroy_stage_queue(&line->to_passes);
+    destroy_stage_queue(&line->to_output);
+
+    return line->all_success;
+}
+
+/*
+ * First stage. Does the checks of process_file_in_table(), so a cached or badly named
+ * file skips the other stages, and runs the preprocessor on the file's own table.
+ */
+void *preprocess_worker(void *arg)
+{
+    pipeline *line = arg;
+    pipeline_item *item;
+
+    while ((item = pop_stage_item(&line->to_preprocess)) != NULL)
+    {
+        item->buffered = begin_buffered_diagnostics(&item->diagnostics);
+
+        if (strlen(item->filename) > MAX_LABEL_LENGTH)
+        {
+            errors_table(FILE_NAME_EXCEED_MAXIMUM, -1);
+            item->success = false;
+            item->finished = true;
+        }
+        else
+        {
+            item->assembler = initialize_assembler_table("");
+
+            /* A missing source is reported by the preprocessor */
+            if (cache_enabled() && compute_cache_key(item->filename, item->assembler->options, item->cache_key))
+            {
+                if (replay_cache_entry(item->cache_key, item->filename, &item->success))
+                {
+                    item->finished = true;
+                }
+                else
+                {
+                    snapshot_outputs(item->filename, item->before);
+                    item->cached = true;
+                }
+            }
+
+            if (!item->finished && !preprocess_stage(item->assembler, item->filename))
+            {
+                item->success = false;
+                item->finished = true;
+            }
+        }
+
+        if (item->buffered)
+        {
+            detach_diagnostics_buffer(&item->diagnostics);
+        }
+
+        push_stage_item(&line->to_passes, item);
+    }
+
+    close_stage_queue(&line->to_passes);
+    return NULL;
+}
+
+/*
+ * Second stage: the CPU bound part of the assembly.
+ */
+void *passes_worker(void *arg)
+{
+    pipeline *line = arg;
+    pipeline_item *item;
+
+    while ((item = pop_stage_item(&line->to_passes)) != NULL)
+    {
+        if (!item->finished)
+        {
+            if (item->buffered)
+            {
+                attach_diagnostics_buffer(&item->diagnostics);
+            }
+
+            if (!passes_stage(item->assembler, item->filename))
+            {
+                item->success = false;
+                item->finished = true;
+            }
+
+            if (item->buffered)
+            {
+                detach_diagnostics_buffer(&item->diagnostics);
+            }
+        }
+
+        push_stage_item(&line->to_output, item);
+    }
+
+    close_stage_queue(&line->to_output);
+    return NULL;
+}
+
+/*
+ * Last stage. The files arrive in submission order, so printing them here
+ * keeps the output of a serial run.
+ */
+void *output_worker(void *arg)
+{
+    pipeline *line = arg;
+    pipeline_item *item;
+
+    while ((item = pop_stage_item(&line->to_output)) != NULL)
+    {
+        if (item->buffered)
+        {
+            attach_diagnostics_buffer(&item->diagnostics);
+        }
+
+        if (!item->finished)
+        {
+            output_stage(item->assembler);
+        }
+
+        if (item->assembler != NULL)
+        {
+            free_assembler_table(item->assembler);
+        }
+
+        if (item->buffered)
+        {
+            end_buffered_diagnostics(&item->diagnostics);
+
+            /* Like process_file_cached(), the entry holds the messages of the file itself */
+            if (item->cached)
+            {
+                store_cache_entry(item->cache_key, item->filename, item->before, &item->diagnostics, item->success);
+            }
+
+            fwrite(item->diagnostics.text, 1, item->diagnostics.size, stdout);
+            free(item->diagnostics.text);
+        }
+
+        if (!item->success)
+        {
+            printf("Error processing file: %s\n", item->filename);
+            line->all_success = false;
+        }
+
+        free(item->filename);
+        free(item);
+    }
+
+    return NULL;
+}
+
+/*
+ * Starts with an empty ring buffer.
+ */
+void init_stage_queue(stage_queue *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+}
+
+/*
+ * Waits for a free slot, so a fast stage can't run far ahead of a slow one.
+ */
+void push_stage_item(stage_queue *queue, pipeline_item *item)
+{
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == PIPELINE_QUEUE_CAPACITY)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+
+    queue->items[(queue->head + queue->count) % PIPELINE_QUEUE_CAPACITY] = item;
+    queue->count++;
+
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Waits for a file, or for the queue to be closed.
+ */
+pipeline_item *pop_stage_item(stage_queue *queue)
+{
+    pipeline_item *item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == 0 && !queue->closed)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+
+    if (queue->count > 0)
+    {
+        item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % PIPELINE_QUEUE_CAPACITY;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+    return item;
+}
+
+/*
+ * Wakes the waiting stage, which drains the queue and then stops.
+ */
+void close_stage_queue(stage_queue *queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Releases the synchronization objects of the queue.
+ */
+void destroy_stage_queue(stage_queue *queue)
+{
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
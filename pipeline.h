@@ -0,0 +1,149 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <pthread.h>
+#include "assembler.h"
+#include "cache.h"
+#include "batch.h"
+
+/* ============================ Pipelined assembly ================================== */
+
+/*
+ * With "--pipeline" every stage of the assembly runs on its own thread:
+ * while file N+1 is preprocessed, file N goes through the two passes
+ * and file N-1 writes its output files. The stages are connected by bounded queues,
+ * so reading, computing and writing overlap even with few cores, and only
+ * a few files are held in memory at a time.
+ * Files leave the last stage in the order they were submitted, so their messages
+ * are printed exactly like a serial run.
+ */
+
+/* Number of files that may wait between two stages */
+#define PIPELINE_QUEUE_CAPACITY 4
+
+/* One file travelling through the pipeline */
+typedef struct pipeline_item
+{
+    char *filename;                          /* Copy of the file name (without extension) */
+    assembler_table *assembler;              /* The file's own table, passed from stage to stage */
+    bool success;                            /* false once a stage failed */
+    bool finished;                           /* Set when the remaining stages have nothing to do */
+    bool buffered;                           /* Whether the diagnostics buffer could be opened */
+    diagnostics_buffer diagnostics;          /* Messages of all the stages of the file */
+    bool cached;                             /* Whether the result is stored in the cache at the end */
+    char cache_key[CACHE_KEY_LENGTH];        /* Cache key of the source */
+    output_snapshot before[OUTPUT_ENDINGS];  /* Output files before the file was assembled */
+} pipeline_item;
+
+/* Bounded FIFO queue between two stages */
+typedef struct stage_queue
+{
+    pipeline_item *items[PIPELINE_QUEUE_CAPACITY]; /* Ring buffer of waiting files */
+    int head;                                      /* Index of the oldest file */
+    int count;                                     /* Number of waiting files */
+    bool closed;                                   /* Set when the previous stage is done */
+    pthread_mutex_t lock;                          /* Protects the queue */
+    pthread_cond_t not_empty;                      /* Signaled when a file is added or the queue is closed */
+    pthread_cond_t not_full;                       /* Signaled when a file is taken */
+} stage_queue;
+
+/* The stages and the queues between them */
+typedef struct pipeline
+{
+    stage_queue to_preprocess;     /* Submitted files */
+    stage_queue to_passes;         /* Preprocessed files */
+    stage_queue to_output;         /* Files that went through both passes */
+    pthread_t preprocess_thread;   /* Runs the preprocessor */
+    pthread_t passes_thread;       /* Runs the first and second pass */
+    pthread_t output_thread;       /* Writes the output files and prints the messages */
+    bool all_success;              /* false once a file failed */
+} pipeline;
+
+/**
+ * Sets up the queues and starts the three stage threads.
+ *
+ * @param line The pipeline to start.
+ * @return true if the pipeline runs, false if a thread couldn't be started (nothing is left to finish).
+ */
+bool start_pipeline(pipeline *line);
+
+/**
+ * Adds a file to the pipeline. Blocks while the first queue is full.
+ *
+ * @param line The running pipeline.
+ * @param filename The file name (copied).
+ */
+void submit_to_pipeline(pipeline *line, const char *filename);
+
+/**
+ * Closes the input, waits for the submitted files to go through every stage, and stops the threads.
+ *
+ * @param line The running pipeline.
+ * @return true if all the files were assembled successfully, false otherwise.
+ */
+bool finish_pipeline(pipeline *line);
+
+/**
+ * Thread function of the first stage: checks the name, restores cached results,
+ * and runs the preprocessor.
+ *
+ * @param arg Pointer to the pipeline.
+ * @return Always NULL.
+ */
+void *preprocess_worker(void *arg);
+
+/**
+ * Thread function of the second stage: runs the first and second pass.
+ *
+ * @param arg Pointer to the pipeline.
+ * @return Always NULL.
+ */
+void *passes_worker(void *arg);
+
+/**
+ * Thread function of the last stage: writes the output files,
+ * stores the result in the cache, prints the messages and frees the file.
+ *
+ * @param arg Pointer to the pipeline.
+ * @return Always NULL.
+ */
+void *output_worker(void *arg);
+
+/**
+ * Initializes an empty, open queue.
+ *
+ * @param queue The queue.
+ */
+void init_stage_queue(stage_queue *queue);
+
+/**
+ * Adds a file to the end of a queue, waiting while the queue is full.
+ *
+ * @param queue The queue.
+ * @param item The file.
+ */
+void push_stage_item(stage_queue *queue, pipeline_item *item);
+
+/**
+ * Takes the oldest file of a queue, waiting while the queue is empty and still open.
+ *
+ * @param queue The queue.
+ * @return The file, or NULL once the queue is closed and empty.
+ */
+pipeline_item *pop_stage_item(stage_queue *queue);
+
+/**
+ * Marks a queue as closed, waking the stage that waits on it.
+ *
+ * @param queue The queue.
+ */
+void close_stage_queue(stage_queue *queue);
+
+/**
+ * Releases the mutex and condition variables of a queue.
+ *
+ * @param queue The closed, empty queue.
+ */
+void destroy_stage_queue(stage_queue *queue);
+
+#endif
@@ -1,33 +1,75 @@
 #include "pre_proc.h"
+#include "pre_proc_parallel.h"
+#include "include_cache.h"
+#include "macro_library.h"
+#include "macro_template.h"
 
 /*
-  This function removes all spaces and tabs from the given line,
-  The cleaned result is stored in 'dest'.
+  Cleans the line in place in a single pass. The write position never passes
+  the read position, so the character before the current one is kept aside
+  for the comment check. Like the checks it replaces, a ';' is an error only
+  after a whitespace, and not as the last character of the line.
+  A call of a parameterized macro is a name, then its arguments in parentheses:
+  a name followed by '(' is looked up whatever comes after it, so a call with
+  text after its arguments is an error of the call and not a plain line.
 */
-void remove_white_spaces(char dest[MAX_LINE_LENGTH], char *line)
+LINE_KIND normalize_line(char line[MAX_LINE_LENGTH], size_t *raw_length, size_t *length, bool *note_error)
 {
-    int i, j = 0;
-    char temp[MAX_LINE_LENGTH];
+    size_t i, j = 0, note = 0, arguments = 0;
+    char previous = '\0';
+    bool name = true;
 
-    /* Initialize the temp buffer with null characters */
-    memset(temp, '\0', MAX_LINE_LENGTH);
-
-    /* Go over the input line character by character */
-    for (i = 0; i < strlen(line); i++)
+    for (i = 0; line[i] != '\0'; i++)
     {
+        /* Remember the first ';' after a whitespace */
+        if (note == 0 && i > 0 && line[i] == ';' && isspace((unsigned char)previous))
+        {
+            note = i;
+        }
+        previous = line[i];
+
         /* Copy only non-whitespace characters */
         if (line[i] != ' ' && line[i] != '\t')
         {
-            temp[j] = line[i];
-            j++;
+            /* A macro call is a name alone on its line */
+            if (line[i] != '\n' && !(line[i] == '_' || isalpha((unsigned char)line[i]) ||
+                                     (j > 0 && isdigit((unsigned char)line[i]))))
+            {
+                /* Arguments may follow the name */
+                if (name && line[i] == '(')
+                {
+                    arguments = j;
+                }
+                name = false;
+            }
+            line[j++] = line[i];
         }
+    }
+    line[j] = '\0';
+
+    *raw_length = i;
+    *length = j;
+    *note_error = note != 0 && note + 1 < i;
 
-  
+    /* expand_macro_call() checks that the arguments end with the line */
+    if (arguments > 0)
+    {
+        name = true;
     }
 
-    temp[j] = '\0';
-    /* Copy cleaned result to destination */
-    strcpy(dest, temp);
+    if (strncmp(line, "mcroend", strlen("mcroend")) == 0)
+    {
+        return LINE_MACRO_END;
+    }
+    if (strncmp(line, "mcro", strlen("mcro")) == 0)
+    {
+        return LINE_MACRO_START;
+    }
+    if (strncmp(line, ".include", strlen(".include")) == 0)
+    {
+        return LINE_INCLUDE;
+    }
+    return name && j > 0 && line[0] != '\n' ? LINE_MACRO_CALL : LINE_PLAIN;
 }
 
 /*
@@ -60,20 +102,42 @@ int my_tokenaizer(char dest[MAX_LINE_LENGTH], char *line, char delimiter)
 
 /*
   Initializes file paths and file pointers used for pre-processing.
-  Adds ".as" and ".am" suffixes to filenames and opens the files accordingly.
+  Adds ".as" and ".am" suffixes to filenames, loads the source into the reader
+  and opens the ".am" file, only when the options ask to keep it.
   Also clears the buffers for line and macro name.
 */
-void files_initialize(assembler_table **assembler, FILE **fp_as, FILE **fp_am,
+void files_initialize(assembler_table **assembler, source_reader *source, am_writer **am,
                       char line[MAX_LINE_LENGTH], char macro_name[MAX_LINE_LENGTH])
 {
+    FILE *fp_as;
 
     /* Generate full path for ".as" and ".am" files */
     add_ending_to_string((*assembler)->assembly_file, (*assembler)->source_file, ".as");
     add_ending_to_string((*assembler)->macro_expanded_file, (*assembler)->source_file, ".am");
 
-    /* Open the input (.as) and output (.am) files */
-    *fp_as = my_fopen((*assembler)->assembly_file, "r");
-    *fp_am = my_fopen((*assembler)->macro_expanded_file, "w");
+    /* A source given as a stream (a pipe, or a library buffer) leaves no files behind */
+    if ((*assembler)->source_stream != NULL)
+    {
+        open_source_reader(source, (*assembler)->source_stream);
+        (*assembler)->open_source = source;
+        *am = NULL;
+    }
+    else
+    {
+        /* Load the input (.as) file, and open the output (.am) file */
+        fp_as = my_fopen((*assembler)->assembly_file, "r");
+        open_source_reader(source, fp_as);
+        fclose(fp_as);
+        (*assembler)->open_source = source;
+        *am = (*assembler)->options->keep_am && !(*assembler)->options->check_only ?
+              open_am_writer((*assembler)->macro_expanded_file, &(*assembler)->expanded_source) : NULL;
+    }
+    (*assembler)->open_am = *am;
+
+    /* Start the expanded source, and its macro calls, from scratch */
+    (*assembler)->expanded_source.length = 0;
+    (*assembler)->expansions.count = 0;
+    (*assembler)->expansions.lines = 0;
 
     /* Clear line and macro_name buffers */
     memset(line, '\0', MAX_LINE_LENGTH);
@@ -84,7 +148,7 @@ void files_initialize(assembler_table **assembler, FILE **fp_as, FILE **fp_am,
   Extracts and validates a macro name from a given line.
   Returns false if invalid.
 */
-bool extract_and_validate_macro_name(char *macro_name, char *line, int line_number, macro *list)
+bool extract_and_validate_macro_name(char *macro_name, char *line, int line_number, const assembler_table *assembler)
 {
     /* clear the macro_name buffer */
     memset(macro_name, '\0', MAX_LINE_LENGTH);
@@ -93,40 +157,38 @@ bool extract_and_validate_macro_name(char *macro_name, char *line, int line_numb
     my_tokenaizer(macro_name, line + strlen("mcro"), '\n');
 
     /* validate the extracted name */
-    return macro_name_examine(macro_name, line_number, list);
+    return macro_name_examine(macro_name, line_number, assembler);
 }
 
 /**
  * Reads the body of a macro from the source file until 'endmcro' is found.
- * Stores each valid line into the macro content list.
+ * Appends each valid line to the macro body.
  *
  */
-bool read_macro_body(FILE *fp_as, macro_content **content, int *line_counter, char *line)
+bool read_macro_body(source_reader *source, text_buffer *body, int *line_counter, char *line)
 {
-    memset(line, '\0', MAX_LINE_LENGTH); /* clear line buffer */
+    size_t raw_length, length;
+    bool note_error;
+    LINE_KIND kind = LINE_PLAIN;
 
-    while (fgets(line, MAX_LINE_LENGTH, fp_as) != NULL)
+    /* At the end of the source the line is left empty */
+    while (read_source_line(source, line))
     {
         (*line_counter)++;
-        remove_white_spaces(line, line); /* clean whitespace */
- 
+        kind = normalize_line(line, &raw_length, &length, &note_error); /* clean whitespace */
 
-        if (strncmp(line, "mcroend", strlen("mcroend")) != 0)
+        if (kind != LINE_MACRO_END)
         {
-            /* add line to macro content list */
-            add_to_content_list(content, line);
+            /* add line to the macro body */
+            append_to_text_buffer(body, line, length);
         }
         else
         {
             break; /* reached 'mcroend' */
         }
-
-        memset(line, '\0', MAX_LINE_LENGTH); /* clear for next read */
     }
 
-    remove_white_spaces(line, line); /* final check */
-
-    if (strncmp(line, "mcroend", strlen("mcroend")) == 0)
+    if (kind == LINE_MACRO_END)
     {
         /* validate that there's no extra text after 'mcroend' */
         if (!examine_macroend(line + strlen("mcroend"), *line_counter))
@@ -142,30 +204,54 @@ bool read_macro_body(FILE *fp_as, macro_content **content, int *line_counter, ch
  * Handles macro declaration: extracts its name, reads its body, and stores it.
 */
 bool macro_trearment(assembler_table **assembler, char line[MAX_LINE_LENGTH],
-                     char macro_name[MAX_LINE_LENGTH], FILE *fp_as,
-                     macro_content **content, int *line_counter)
+                     char macro_name[MAX_LINE_LENGTH], source_reader *source,
+                     text_buffer *body, int *line_counter)
 {
+    int definition_line = *line_counter;
+    char parameter_names[MAX_MACRO_PARAMETERS][MAX_LINE_LENGTH];
+    char *parameters = strchr(line, '(');
+    int parameter_count = 0;
+    bool valid_parameters = true;
+
+    /* The parameters are read and cut from the line, what is left is the name */
+    if (parameters != NULL)
+    {
+        valid_parameters = split_macro_parameters(parameters, parameter_names, &parameter_count);
+        *parameters = '\0';
+    }
+
     /* extract and validate macro name */
-    if (!extract_and_validate_macro_name(macro_name, line, *line_counter, (*assembler)->macro_list))
+    if (!extract_and_validate_macro_name(macro_name, line, *line_counter, *assembler))
     {
         return false;
     }
 
+    if (!valid_parameters)
+    {
+        errors_table(MACRO_INVALID_PARAMETERS, *line_counter);
+        return false;
+    }
+
 
 
     /* read macro body and check for errors */
-    if (!read_macro_body(fp_as, content, line_counter, line))
+    if (!read_macro_body(source, body, line_counter, line))
     {
         memset(line, '\0', MAX_LINE_LENGTH);
-        *content = NULL;
+        body->length = 0; /* the body is dropped with the macro */
         return false;
     }
 
-    /* add macro to macro list */
-    add_to_macro_list(&(*assembler)->macro_list, macro_name, *content);
+    /* add macro to macro list, with the slots of its parameters */
+    add_to_macro_list(*assembler, macro_name, body);
+    (*assembler)->macro_list->defined_line = definition_line;
+    if (parameter_count > 0)
+    {
+        compile_macro_template(*assembler, (*assembler)->macro_list, parameter_names, parameter_count);
+    }
 
-    /* reset temporary content and name */
-    *content = NULL;
+    /* reset temporary body and name */
+    body->length = 0;
     memset(macro_name, '\0', MAX_LINE_LENGTH);
 
     return true;
@@ -173,26 +259,271 @@ bool macro_trearment(assembler_table **assembler, char line[MAX_LINE_LENGTH],
 
 
 /*
- * Checks if the line is a macro usage or a regular line.
- * Expands macro content or writes the line to the output.
+ * Adds expanded text to the in-memory source of the first pass,
+ * and to the .am file if it is kept. The .am file takes it from the expanded source.
+ */
+void write_expanded_text(assembler_table **assembler, am_writer *am, const char *text, long length)
+{
+    long offset = (*assembler)->expanded_source.length;
+
+    append_to_text_buffer(&(*assembler)->expanded_source, text, length);
+
+    if (am != NULL)
+    {
+        add_am_piece(am, NULL, offset, length);
+    }
+}
+
+/*
+ * Like write_expanded_text(), but the .am file takes the body from the macro itself,
+ * which stays put until the file is done.
+ */
+void write_macro_body(assembler_table **assembler, am_writer *am, const macro *source)
+{
+    append_to_text_buffer(&(*assembler)->expanded_source, source->body, source->body_length);
+
+    if (am != NULL)
+    {
+        add_am_piece(am, source->body, 0, source->body_length);
+    }
+}
+
+/*
+ * The calls keep their order; every one starts its lines where it started them in the part,
+ * after the lines written before the part.
+ */
+void write_expanded_part(assembler_table **assembler, am_writer *am, const char *text, long length,
+                         const macro_expansion *calls, long call_count, long first_line, long lines)
+{
+    expansion_map *expansions = &(*assembler)->expansions;
+    long i, lines_before = expansions->lines;
+
+    for (i = 0; i < call_count; i++)
+    {
+        expansions->lines = lines_before + calls[i].first_line - first_line - 1;
+        add_macro_expansion(expansions, lookup_macro(*assembler, calls[i].source->macro_name));
+    }
+    expansions->lines = lines_before + lines;
+
+    write_expanded_text(assembler, am, text, length);
+}
+
+/*
+ * The macros of the file come first. A macro of the library gets its node
+ * the first time the file calls it, and is found in library_macros after that.
+ */
+macro *lookup_macro(assembler_table *assembler, const char *name)
+{
+    macro *found = find_macro(&assembler->macros, name);
+    const library_macro *record;
+
+    if (found == NULL && assembler->options->macro_library != NULL)
+    {
+        found = find_macro(&assembler->library_macros, name);
+        if (found == NULL && (record = find_library_macro(assembler->options->macro_library, name)) != NULL)
+        {
+            found = add_library_macro(assembler, record);
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Like lookup_macro(), without giving a macro of the library a node.
+ */
+bool macro_defined(const assembler_table *assembler, const char *name)
+{
+    return find_macro(&assembler->macros, name) != NULL ||
+           (assembler->options->macro_library != NULL && find_library_macro(assembler->options->macro_library, name) != NULL);
+}
+
+/*
+ * Reads the file name between the quotation marks, with nothing after them.
+ */
+bool extract_include_path(char path[MAX_LINE_LENGTH], const char *text)
+{
+    const char *end;
+
+    if (text[0] != '"' || (end = strchr(text + 1, '"')) == NULL || end == text + 1)
+    {
+        return false;
+    }
+    if (end[1] != '\0' && strcmp(end + 1, "\n") != 0)
+    {
+        return false;
+    }
+
+    memcpy(path, text + 1, end - text - 1);
+    path[end - text - 1] = '\0';
+    return true;
+}
+
+/*
+ * Pastes the expanded lines of an included file, and defines its macros from this line on.
+ * The file is preprocessed once for the whole run (see get_included_file()).
+ * If the source already has a macro of the same name nothing is included,
+ * like the definition would have been an error in the source itself.
  */
-void handle_macro_usage_or_regular_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE *fp_am)
+void handle_include(char line[MAX_LINE_LENGTH], int line_number, assembler_table **assembler, am_writer *am, bool *final_error)
 {
-    macro *macro_use = find_macro((*assembler)->macro_list, line);
-    macro_content *c;
+    char path[MAX_LINE_LENGTH];
+    const include_entry *entry = NULL, *cached = NULL;
+    const include_frame *includer = (*assembler)->includer;
+    include_frame source_frame;
+    diagnostic_record *message;
+    macro *included;
+    text_buffer body;
+    ERRORS error = INCLUDE_INVALID_PATH;
+    bool recursive = false;
+
+    /* A source read from its file is the first file of the chain */
+    if (includer == NULL && (*assembler)->source_stream == NULL &&
+        source_include_frame((*assembler)->assembly_file, &source_frame))
+    {
+        includer = &source_frame;
+    }
+
+    if ((*assembler)->options->memory_only)
+    {
+        error = INCLUDE_NOT_ALLOWED;
+    }
+    else if (extract_include_path(path, line + strlen(".include")))
+    {
+        entry = cached = get_included_file(path, includer, &recursive);
+        error = recursive ? INCLUDE_RECURSIVE : INCLUDE_FAILED_TO_OPEN;
+    }
+
+    if (entry != NULL && !entry->success)
+    {
+        /* The messages of the included file come first, then where it was included.
+           Their line numbers are lines of that file, so they start with its path */
+        for (message = entry->messages; message != NULL; message = message->next)
+        {
+            diagnostic_line(line_number);
+            diagnostic_printf("%s: %s\n", path, message->message);
+        }
+        error = INCLUDE_HAS_ERRORS;
+        entry = NULL;
+    }
 
-    /* If line matches a macro name, write its full content */
-    if (macro_use != NULL)
+    for (included = entry != NULL ? entry->table->macro_list : NULL; included != NULL; included = included->next)
     {
-        for (c = macro_use->content; c != NULL; c = c->next)
+        if (macro_defined(*assembler, included->macro_name))
         {
-            fprintf(fp_am, "%s", c->content_line);
+            error = MACRO_ALREADY_DEFINED;
+            entry = NULL;
+            break;
         }
     }
+
+    if (entry == NULL)
+    {
+        release_included_file(cached);
+        errors_table(error, line_number);
+        *final_error = false;
+        (*assembler)->error_count++;
+        return;
+    }
+
+    /* The bodies are copied, the first pass keeps what it compiles in the macros of this file */
+    for (included = entry->table->macro_list; included != NULL; included = included->next)
+    {
+        body.text = included->body;
+        body.length = body.capacity = included->body_length;
+        add_to_macro_list(*assembler, included->macro_name, &body);
+        (*assembler)->macro_list->defined_line = line_number;
+        copy_macro_template(*assembler, (*assembler)->macro_list, included);
+    }
+
+    write_expanded_part(assembler, am, entry->table->expanded_source.text, entry->table->expanded_source.length,
+                        entry->table->expansions.items, entry->table->expansions.count, 0, entry->table->expansions.lines);
+    release_included_file(cached);
+}
+
+/*
+ * The arguments point into the line, and the expansion goes straight into the expanded source.
+ * It isn't noted as a macro call, since its lines differ from one call to the other.
+ */
+void expand_macro_call(char line[MAX_LINE_LENGTH], int line_number, const macro *template,
+                       assembler_table **assembler, am_writer *am, bool *final_error)
+{
+    macro_argument arguments[MAX_MACRO_PARAMETERS];
+    long offset = (*assembler)->expanded_source.length, lines;
+    ERRORS error = MACRO_WRONG_ARGUMENTS;
+    int count;
+
+    if (split_macro_arguments(line + strcspn(line, "(\n"), arguments, &count) && count == template->parameter_count)
+    {
+        if (fill_macro_template(template, arguments, &(*assembler)->expanded_source, &lines))
+        {
+            (*assembler)->expansions.lines += lines;
+            if (am != NULL)
+            {
+                add_am_piece(am, NULL, offset, (*assembler)->expanded_source.length - offset);
+            }
+            return;
+        }
+
+        error = MACRO_LINE_TOO_LONG;
+        (*assembler)->expanded_source.length = offset;
+    }
+
+    errors_table(error, line_number);
+    *final_error = false;
+    (*assembler)->error_count++;
+}
+
+/*
+ * Checks if the line is a macro usage or a regular line.
+ * Expands the macro body or writes the line to the output.
+ */
+void handle_macro_usage_or_regular_line(char line[MAX_LINE_LENGTH], size_t length, LINE_KIND kind, int line_number,
+                                        assembler_table **assembler, am_writer *am, bool *final_error)
+{
+    /* Only a line that is a name can be a macro call */
+    macro *macro_use = kind == LINE_MACRO_CALL ? lookup_macro(*assembler, line) : NULL;
+    const macro_library *library = (*assembler)->options->macro_library;
+    const library_macro *record;
+
+    /* A macro of the library that add_library_macro() refused is an error, not a plain line */
+    if (kind == LINE_MACRO_CALL && macro_use == NULL && library != NULL &&
+        (record = find_library_macro(library, line)) != NULL && library_macro_rejected(library, record))
+    {
+        diagnostic_line(line_number);
+        diagnostic_printf("Error on line %d: The macro %.*s of the library %s is damaged.\n",
+                          line_number, (int)strcspn(line, "(\n"), line, library->path);
+        *final_error = false;
+        (*assembler)->error_count++;
+        return;
+    }
+
+    /* A macro is known only after its definition (the definitions may have been read first) */
+    if (macro_use != NULL && macro_use->defined_line >= line_number)
+    {
+        macro_use = NULL;
+    }
+
+    /* A macro with parameters, or a call with arguments, fills the slots of the macro */
+    if (macro_use != NULL && (macro_use->parameter_count > 0 || strchr(line, '(') != NULL))
+    {
+        expand_macro_call(line, line_number, macro_use, assembler, am, final_error);
+    }
+    /* If line matches a macro name, write its whole body at once,
+       and note where, so the first pass can reuse the lines it already compiled */
+    else if (macro_use != NULL)
+    {
+        add_macro_expansion(&(*assembler)->expansions, macro_use);
+        write_macro_body(assembler, am, macro_use);
+    }
     /* Otherwise, write the line as-is (if not empty) */
     else if (line[0] != '\n')
     {
-        fprintf(fp_am, "%s", line);
+        write_expanded_text(assembler, am, line, length);
+        if (length > 0)
+        {
+            (*assembler)->expansions.lines++;
+        }
     }
 }
 
@@ -202,18 +533,18 @@ void handle_macro_usage_or_regular_line(char line[MAX_LINE_LENGTH], assembler_ta
  * If so, handles the macro block and updates the macro list.
  * Returns true if this line was a macro definition (success or failure).
  */
-bool handle_macro_definition(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE *fp_as,
-                             char macro_name[MAX_LINE_LENGTH], macro_content **content,
+bool handle_macro_definition(char line[MAX_LINE_LENGTH], LINE_KIND kind, assembler_table **assembler, source_reader *source,
+                             char macro_name[MAX_LINE_LENGTH], text_buffer *body,
                              int *line_counter, bool *final_error)
 {
     /* check if line starts a macro definition (but not 'mcroend') */
-    if (strncmp(line, "mcro", strlen("mcro")) == 0 &&
-        strncmp(line, "mcroend", strlen("mcroend")) != 0)
+    if (kind == LINE_MACRO_START)
     {
         /* handle macro definition and update error status */
-        if (!macro_trearment(assembler, line, macro_name, fp_as, content, line_counter))
+        if (!macro_trearment(assembler, line, macro_name, source, body, line_counter))
         {
             *final_error = false;
+            (*assembler)->error_count++;
         }
         return true;
     }
@@ -226,57 +557,68 @@ bool handle_macro_definition(char line[MAX_LINE_LENGTH], assembler_table **assem
  * Processes a single line: handles macro definition, usage, or regular line.
  * Returns false if an error occurred, true otherwise.
  */
-bool process_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE *fp_as, FILE *fp_am,
-                  char macro_name[MAX_LINE_LENGTH], macro_content **content,
+bool process_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, source_reader *source, am_writer *am,
+                  char macro_name[MAX_LINE_LENGTH], text_buffer *body,
                   int *line_counter, bool *final_error)
 {
-    size_t len;
-    int ch;
+    size_t raw_length, length;
+    bool note_error;
+    LINE_KIND kind;
+
+    /* clean the line, and find its kind and errors, in one pass */
+    kind = normalize_line(line, &raw_length, &length, &note_error);
 
     /* check for comment errors  */
-    if (!handle_notes_error(line, *line_counter))
+    if (note_error)
     {
+        errors_table(ERROR_NOTE_WITH_SPACE, *line_counter);
         *final_error = false;
+        (*assembler)->error_count++;
         return true; /* skip the line, but not a fatal error */
     }
 
-    /* check for overly long line */
-    len = strlen(line);
-    if (len == MAX_LINE_LENGTH - 1 && line[len - 1] != '\n')
+    /* check for overly long line (the newline stays at the end of a cleaned line) */
+    if (raw_length == MAX_LINE_LENGTH - 1 && (length == 0 || line[length - 1] != '\n'))
     {
         errors_table(LINE_LENGTH_EXCEED_MAXIMUM, *line_counter);
         *final_error = false;
+        (*assembler)->error_count++;
 
         /* consume the rest of the long line */
-        while ((ch = fgetc(fp_as)) != '\n' && ch != EOF)
-            ;
+        skip_source_line(source);
     }
 
-    /* remove extra white spaces */
-    remove_white_spaces(line, line);
-
     /* handle macro definition if found */
-    if (handle_macro_definition(line, assembler, fp_as, macro_name, content, line_counter, final_error))
+    if (handle_macro_definition(line, kind, assembler, source, macro_name, body, line_counter, final_error))
+    {
+        return true;
+    }
+
+    /* paste an included file */
+    if (kind == LINE_INCLUDE)
     {
+        handle_include(line, *line_counter, assembler, am, final_error);
         return true;
     }
 
     /* handle macro usage or write regular line */
-    handle_macro_usage_or_regular_line(line, assembler, fp_am);
+    handle_macro_usage_or_regular_line(line, length, kind, *line_counter, assembler, am, final_error);
     return true;
 }
 
 /*
   Main preprocessor function. Reads each line of the ".as" file,
-  handles macro definitions and macro usages, and writes the expanded
-  version to the ".am" file. In case of errors, deletes the output file.
+  handles macro definitions and macro usages, and keeps the expanded
+  version in memory for the first pass (and in the ".am" file if asked to).
+  In case of errors, deletes the output file.
   Returns true if successful, false otherwise.
 */
 bool pre_proc(assembler_table **assembler)
 {
     char line[MAX_LINE_LENGTH], macro_name[MAX_LINE_LENGTH];
-    macro_content *content = NULL;
-    FILE *fp_as, *fp_am;
+    text_buffer body = {NULL, 0, 0}; /* Body of the macro being read */
+    source_reader *source = my_malloc(sizeof(source_reader)); /* Reachable from the table, see abandon_pre_proc() */
+    am_writer *am;
 
     /* Counter for line number */
     int *line_counter = my_malloc(sizeof(int));
@@ -284,29 +626,67 @@ bool pre_proc(assembler_table **assembler)
     bool final_error = true;
     *line_counter = 1;
     /* Open files and initialize buffers */
-    files_initialize(assembler, &fp_as, &fp_am, line, macro_name);
+    files_initialize(assembler, source, &am, line, macro_name);
 
-    /* Process lines from .as file */
-    while (fgets(line, MAX_LINE_LENGTH, fp_as))
+    /* A large source is expanded by several threads, with the same result */
+    if (parallel_preprocessing_wanted(*assembler, source))
     {
- 
-        process_line(line, assembler, fp_as, fp_am, macro_name, &content, line_counter, &final_error);
-        memset(line, '\0', MAX_LINE_LENGTH);
-        (*line_counter)++;
+        final_error = parallel_pre_proc(assembler, source, am);
     }
 
- 
-
-    /* If any error occurred, delete the generated file */
-    if (final_error == false)
+    /* Process lines from .as file, unless the file already has too many errors */
+    else
     {
-        safe_remove((*assembler)->macro_expanded_file);
+        while (!error_limit_reached(*assembler) && read_source_line(source, line))
+        {
+            process_line(line, assembler, source, am, macro_name, &body, line_counter, &final_error);
+            (*line_counter)++;
+        }
     }
 
+ 
+
     /* Clean up */
     free(line_counter);
-    fclose(fp_as);
-    fclose(fp_am);
+    free_text_buffer(&body);
+    close_source_reader(source);
+    free(source);
+    (*assembler)->open_source = NULL;
+    (*assembler)->open_am = NULL;
+    if (am != NULL)
+    {
+        if (!close_am_writer(am))
+        {
+            final_error = false;
+            (*assembler)->error_count++;
+        }
+
+        /* If any error occurred, delete the generated file */
+        if (final_error == false)
+        {
+            safe_remove((*assembler)->macro_expanded_file);
+        }
+    }
 
     return final_error;
 }
+
+/*
+ * The frames of pre_proc() are gone, so everything is reached through the table.
+ */
+void abandon_pre_proc(assembler_table *assembler)
+{
+    if (assembler->open_source != NULL)
+    {
+        close_source_reader(assembler->open_source);
+        free(assembler->open_source);
+        assembler->open_source = NULL;
+    }
+
+    if (assembler->open_am != NULL)
+    {
+        discard_am_writer(assembler->open_am);
+        assembler->open_am = NULL;
+        remove(assembler->macro_expanded_file); /* Not safe_remove(), which may be fatal again */
+    }
+}
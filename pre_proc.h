@@ -2,28 +2,50 @@
 #define PREPROCESSOR_H
 
 #include <stdio.h>
-#include "assembler.h"  /* for assembler_table, macro, macro_content, bool, etc. */
+#include "assembler.h"  /* for assembler_table, macro, text_buffer, bool, etc. */
 
 
+/* What a cleaned line of the source is to the preprocessor */
+typedef enum LINE_KIND
+{
+    LINE_PLAIN,       /* Any other line, copied to the expanded source */
+    LINE_MACRO_START, /* Starts with "mcro" (but not "mcroend") */
+    LINE_MACRO_END,   /* Starts with "mcroend" */
+    LINE_MACRO_CALL,  /* Only a name, or a name and '(', which may be a macro call */
+    LINE_INCLUDE      /* Starts with ".include" */
+} LINE_KIND;
+
 /* ============================ Functions of macro procces ================================== */
 
+/**
+ * Cleans a source line in one scan: removes the spaces and tabs in place,
+ * finds a comment (';') that follows a whitespace, measures the line and classifies it.
+ *
+ * @param line The line, cleaned in place.
+ * @param raw_length Receives the length of the line before the cleaning.
+ * @param length Receives the length of the cleaned line.
+ * @param note_error Receives true if a ';' follows a whitespace (not as the last character).
+ * @return The kind of the cleaned line.
+ */
+LINE_KIND normalize_line(char line[MAX_LINE_LENGTH], size_t *raw_length, size_t *length, bool *note_error);
+
 /**
  * Processes a single line from the source file during preprocessing.
  * Handles comments, line length validation, macro definitions, and macro usage.
  *
  * @param line The line to process.
  * @param assembler Pointer to the assembler table.
- * @param fp_as Source file pointer (.as).
- * @param fp_am Output file pointer (.am).
+ * @param source Reader of the source (.as).
+ * @param am Writer of the .am file, or NULL if the file is not kept.
  * @param macro_name Buffer for storing the current macro name.
- * @param content Pointer to store macro body content.
+ * @param body Buffer for the body of the macro being defined.
  * @param line_counter Current line number (for error reporting).
  * @param final_error Indicates if a fatal error occurred during processing.
  * @return true if the line was processed, false if skipped.
  */
 
-bool process_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE *fp_as, FILE *fp_am,
-                  char macro_name[MAX_LINE_LENGTH], macro_content **content,
+bool process_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, source_reader *source, am_writer *am,
+                  char macro_name[MAX_LINE_LENGTH], text_buffer *body,
                   int *line_counter, bool *final_error);
                   
 
@@ -31,28 +53,106 @@ bool process_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE
  * Checks if the current line starts a macro definition and handles it.
  *
  * @param line The current line being processed.
+ * @param kind The kind of the line (see normalize_line()).
  * @param assembler Pointer to the assembler table.
- * @param fp_as Source file pointer (.as).
+ * @param source Reader of the source (.as).
  * @param macro_name Buffer to store the macro name.
- * @param content Pointer to store the macro body content.
+ * @param body Buffer for the body of the macro.
  * @param line_counter Current line number (for error reporting).
  * @param final_error Indicator for fatal errors during macro processing.
  * @return true if the line is a macro definition (handled or not), false otherwise.
  */
 
-bool handle_macro_definition(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE *fp_as,
-                             char macro_name[MAX_LINE_LENGTH], macro_content **content,
+bool handle_macro_definition(char line[MAX_LINE_LENGTH], LINE_KIND kind, assembler_table **assembler, source_reader *source,
+                             char macro_name[MAX_LINE_LENGTH], text_buffer *body,
                              int *line_counter, bool *final_error);
 
 /**
- * Writes a line to the output file, expanding macros if used.
+ * Writes a line to the expanded source, expanding macros if used.
+ * A call with arguments, or of a macro with parameters, is expanded by expand_macro_call().
  *
  * @param line The current line to process.
+ * @param length The length of the line.
+ * @param kind The kind of the line; only a LINE_MACRO_CALL is looked up in the macros.
+ * @param line_number The line number, only macros defined above it are expanded.
  * @param assembler Pointer to the assembler table (includes macro list).
- * @param fp_am Output file pointer (.am).
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param final_error Set to false if a macro call is invalid.
  */
 
-void handle_macro_usage_or_regular_line(char line[MAX_LINE_LENGTH], assembler_table **assembler, FILE *fp_am);
+void handle_macro_usage_or_regular_line(char line[MAX_LINE_LENGTH], size_t length, LINE_KIND kind, int line_number,
+                                        assembler_table **assembler, am_writer *am, bool *final_error);
+
+/**
+ * Expands a call of a parameterized macro by filling its slots with the arguments of the call.
+ *
+ * @param line The cleaned line of the call.
+ * @param line_number The line number (for error reporting).
+ * @param template The called macro.
+ * @param assembler Pointer to the assembler table.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param final_error Set to false if the arguments don't match the parameters.
+ */
+void expand_macro_call(char line[MAX_LINE_LENGTH], int line_number, const macro *template,
+                       assembler_table **assembler, am_writer *am, bool *final_error);
+
+/**
+ * Adds text to the expanded source kept in the table for the first pass,
+ * and writes it to the .am file if the file is kept.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param text The text, one or more whole lines.
+ * @param length Number of bytes of the text.
+ */
+void write_expanded_text(assembler_table **assembler, am_writer *am, const char *text, long length);
+
+/**
+ * Adds the body of a called macro to the expanded source, and to the .am file if it is kept,
+ * where it is written straight from the macro.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param source The called macro.
+ */
+void write_macro_body(assembler_table **assembler, am_writer *am, const macro *source);
+
+/**
+ * Adds expanded text that was made apart from this source (an included file,
+ * or a part of the source expanded by another thread), with its macro calls.
+ * The calls are matched to the macros of this table by their names.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param text The text, whole lines.
+ * @param length Number of bytes of the text.
+ * @param calls The macro calls of the text.
+ * @param call_count Number of calls.
+ * @param first_line Number of lines that came before the text where it was made.
+ * @param lines Number of lines of the text.
+ */
+void write_expanded_part(assembler_table **assembler, am_writer *am, const char *text, long length,
+                         const macro_expansion *calls, long call_count, long first_line, long lines);
+
+/**
+ * Handles an .include line: pastes the expanded lines of the file and defines its macros.
+ *
+ * @param line The cleaned line.
+ * @param line_number The line number (for error reporting).
+ * @param assembler Pointer to the assembler table.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param final_error Set to false if the file can't be included.
+ */
+void handle_include(char line[MAX_LINE_LENGTH], int line_number, assembler_table **assembler, am_writer *am, bool *final_error);
+
+/**
+ * Reads the file name of an .include line.
+ *
+ * @param path Receives the file name.
+ * @param text The cleaned line after ".include".
+ * @return true if the name is in quotation marks, with nothing after it.
+ */
+bool extract_include_path(char path[MAX_LINE_LENGTH], const char *text);
 
 /**
  * Handles macro declaration: extracts its name, reads its body, and stores it.
@@ -60,44 +160,62 @@ void handle_macro_usage_or_regular_line(char line[MAX_LINE_LENGTH], assembler_ta
  * @param assembler Pointer to the assembler table.
  * @param line The current line being read.
  * @param macro_name Buffer to store the macro's name.
- * @param fp_as Pointer to the input file.
- * @param content Pointer to hold the macro's body content.
+ * @param source Reader of the source.
+ * @param body Buffer for the macro's body.
  * @param line_counter Current line number in the file.
  * @return true if macro was processed successfully, false otherwise.
  */
 
 bool macro_trearment(assembler_table **assembler, char line[MAX_LINE_LENGTH],
-                     char macro_name[MAX_LINE_LENGTH], FILE *fp_as,
-                     macro_content **content, int *line_counter);
+                     char macro_name[MAX_LINE_LENGTH], source_reader *source,
+                     text_buffer *body, int *line_counter);
 
 /**
  * Reads the body of a macro from the source file until 'endmcro' is found.
- * Stores each valid line into the macro content list.
+ * Appends each valid line to the macro body.
  *
- * @param fp_as Pointer to the source file.
- * @param content Pointer to the macro content list to fill.
+ * @param source Reader of the source.
+ * @param body Buffer to fill with the body.
  * @param line_counter Pointer to the current line number.
  * @param line Buffer to read and process each line.
  * @return true if the macro ended correctly with 'endmcro', false otherwise.
  */
 
-bool read_macro_body(FILE *fp_as, macro_content **content, int *line_counter, char *line);
+bool read_macro_body(source_reader *source, text_buffer *body, int *line_counter, char *line);
+
+/**
+ * Looks up a macro by name in the hash index of the macros.
+ * The name ends at a '\n', a '(' or the end of the string, so a cleaned line can be given as is.
+ *
+ * @param index The macro index.
+ * @param name The name, or a line that may be a macro call.
+ * @return Pointer to matching macro, or NULL if not found.
+ */
+macro *find_macro(const macro_index *index, const char *name);
 
 /**
- * Searches a linked list of macros for one with the given name.
+ * Finds the macro a file calls: one it defined or included, or one of the macro library.
+ *
+ * @param assembler The table of the file.
+ * @param name The name, or a line that may be a macro call.
  * @return Pointer to matching macro, or NULL if not found.
  */
-macro *find_macro(macro *head, char *name);
+macro *lookup_macro(assembler_table *assembler, const char *name);
 
 /**
- * Add a new content line to the macro content linked list.
+ * Checks if a name is taken by a macro of the file or of the macro library.
+ *
+ * @param assembler The table of the file.
+ * @param name The name.
+ * @return true if a macro has this name.
  */
-void add_to_content_list(macro_content **head, char *content);
+bool macro_defined(const assembler_table *assembler, const char *name);
 
 /**
- * Add a new macro with given name and content to the macro linked list.
+ * Add a new macro with given name and body to the macro linked list and to the macro index.
+ * The macro and a copy of the body are allocated from the macro arena of the table.
  */
-void add_to_macro_list(macro **head, char *macro_name, macro_content *content);
+void add_to_macro_list(assembler_table *assembler, char *macro_name, text_buffer *body);
 
 
 /* ============================ Functions of error handling ================================== */
@@ -108,11 +226,11 @@ void add_to_macro_list(macro **head, char *macro_name, macro_content *content);
  * @param macro_name Buffer to store the extracted macro name.
  * @param line The input line containing the macro definition.
  * @param line_number The current line number (used for error reporting).
- * @param list Pointer to the existing macro list.
+ * @param assembler The table with the existing macros.
  * @return true if the macro name is valid, false otherwise.
  */
 
-bool extract_and_validate_macro_name(char *macro_name, char *line, int line_number, macro *list);
+bool extract_and_validate_macro_name(char *macro_name, char *line, int line_number, const assembler_table *assembler);
 
 /**
  * Validates a macro name according to assembler rules.
@@ -120,11 +238,11 @@ bool extract_and_validate_macro_name(char *macro_name, char *line, int line_numb
  *
  * @param macro_name The macro name to validate.
  * @param line_counter Line number (used for error reporting).
- * @param macro_list List of already defined macros.
+ * @param assembler The table with the already defined macros.
  * @return true if the macro name is valid, false otherwise.
  */
 
-bool macro_name_examine(char macro_name[], int line_counter, macro *macro_list);
+bool macro_name_examine(char macro_name[], int line_counter, const assembler_table *assembler);
 
 /**
  * Checks that there is no extra text after the 'mcroend' keyword.
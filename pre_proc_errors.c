@@ -11,7 +11,7 @@
 
   Returns false and reports an error to the errors table if any rule is violated.
 */
-bool macro_name_examine(char macro_name[], int line_counter, macro *macro_list) {
+bool macro_name_examine(char macro_name[], int line_counter, const assembler_table *assembler) {
     int i;
 
     /* Check for maximum allowed length */
@@ -26,8 +26,8 @@ bool macro_name_examine(char macro_name[], int line_counter, macro *macro_list)
         return false;
     }
 
-    /* Check if macro name already exists */
-    if (find_macro(macro_list, macro_name) != NULL) {
+    /* Check if macro name already exists (in the file or in the macro library) */
+    if (macro_defined(assembler, macro_name)) {
         errors_table(MACRO_ALREADY_DEFINED, line_counter);
         return false;
     }
@@ -0,0 +1,395 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "pre_proc_parallel.h"
+
+/*
+ * Only a large source is worth the threads, and only without an error limit.
+ */
+bool parallel_preprocessing_wanted(const assembler_table *assembler, const source_reader *source)
+{
+    return assembler->options->preprocess_threads > 1 && assembler->options->max_errors == 0 &&
+           source->length >= 2 * PREPROCESS_CHUNK_MIN_SIZE;
+}
+
+/*
+ * Scans the definitions, expands the chunks on their threads, and joins them.
+ * The messages of both phases are recorded, and printed at the end by line.
+ */
+bool parallel_pre_proc(assembler_table **assembler, source_reader *source, am_writer *am)
+{
+    segment_list segments = {NULL, 0, 0};
+    text_buffer scanned_text;
+    expansion_map scanned_calls;
+    diagnostics_buffer definitions;
+    preprocess_chunk *chunks;
+    long chunk_size, size;
+    int threads = (*assembler)->options->preprocess_threads;
+    int i, first, chunk_count = 0;
+    bool recorded, final_error = true;
+
+    chunk_size = (source->length + threads - 1) / threads;
+    if (chunk_size < PREPROCESS_CHUNK_MIN_SIZE)
+    {
+        chunk_size = PREPROCESS_CHUNK_MIN_SIZE;
+    }
+
+    recorded = begin_recorded_diagnostics(&definitions);
+    scan_macro_definitions(assembler, source, chunk_size, &segments, &final_error);
+    if (recorded)
+    {
+        end_buffered_diagnostics(&definitions);
+    }
+
+    /* The text of the included files is taken aside, the chunks copy it in its place */
+    scanned_text = (*assembler)->expanded_source;
+    scanned_calls = (*assembler)->expansions;
+    (*assembler)->expanded_source.text = NULL;
+    (*assembler)->expanded_source.length = 0;
+    (*assembler)->expanded_source.capacity = 0;
+    (*assembler)->expansions.items = NULL;
+    (*assembler)->expansions.count = 0;
+    (*assembler)->expansions.capacity = 0;
+    (*assembler)->expansions.lines = 0;
+
+    /* Consecutive segments of about chunk_size bytes make a chunk */
+    chunks = my_malloc(sizeof(preprocess_chunk) * (segments.count > 0 ? segments.count : 1));
+    for (first = 0; first < segments.count; first = i)
+    {
+        size = 0;
+        for (i = first; i < segments.count && size < chunk_size; i++)
+        {
+            size += segments.items[i].end - segments.items[i].start;
+        }
+
+        chunks[chunk_count].source = source;
+        chunks[chunk_count].scanned_text = &scanned_text;
+        chunks[chunk_count].scanned_calls = &scanned_calls;
+        chunks[chunk_count].segments = segments.items + first;
+        chunks[chunk_count].segment_count = i - first;
+        chunk_count++;
+    }
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        /* The copy shares the macros, which are only read from now on.
+           The macros of the library it calls get nodes of its own */
+        chunks[i].table = **assembler;
+        chunks[i].table.macro_storage.blocks = NULL;
+        chunks[i].table.library_macros.slots = NULL;
+        chunks[i].table.library_macros.capacity = 0;
+        chunks[i].table.library_macros.count = 0;
+        chunks[i].table.expanded_source.text = NULL;
+        chunks[i].table.expanded_source.length = 0;
+        chunks[i].table.expanded_source.capacity = 0;
+        chunks[i].table.expansions.items = NULL;
+        chunks[i].table.expansions.count = 0;
+        chunks[i].table.expansions.capacity = 0;
+        chunks[i].table.expansions.lines = 0;
+        chunks[i].table.error_count = 0;
+        chunks[i].success = true;
+
+        /* Without a thread the chunk is expanded right away */
+        chunks[i].started = pthread_create(&chunks[i].thread, NULL, expand_chunk, &chunks[i]) == 0;
+        if (!chunks[i].started)
+        {
+            expand_chunk(&chunks[i]);
+        }
+    }
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        if (chunks[i].started)
+        {
+            pthread_join(chunks[i].thread, NULL);
+        }
+
+        join_chunk(assembler, am, &chunks[i]);
+        if (!chunks[i].success)
+        {
+            final_error = false;
+        }
+    }
+
+    /* Without a record the messages of the definitions are already printed,
+       but the chunks that recorded theirs still have to print them */
+    print_chunk_diagnostics(recorded ? definitions.records : NULL, chunks, chunk_count);
+    if (recorded)
+    {
+        free_diagnostic_records(definitions.records);
+        free(definitions.text);
+    }
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        if (chunks[i].recorded)
+        {
+            free_diagnostic_records(chunks[i].diagnostics.records);
+            free(chunks[i].diagnostics.text);
+        }
+    }
+
+    free(chunks);
+    free(segments.items);
+    free_text_buffer(&scanned_text);
+    free(scanned_calls.items);
+
+    return final_error;
+}
+
+/*
+ * "mcro" followed by anything but "end", or ".include".
+ */
+bool handled_by_scan(const char *text, long length)
+{
+    int matched = cleaned_prefix_length(text, length, "mcroend");
+
+    return (matched >= 4 && matched < 7) || cleaned_prefix_length(text, length, ".include") == 8;
+}
+
+/*
+ * Skips the spaces and tabs like normalize_line() does, and stops at a null character like it.
+ */
+int cleaned_prefix_length(const char *text, long length, const char *keyword)
+{
+    long i;
+    int matched = 0;
+
+    for (i = 0; i < length && text[i] != '\0' && keyword[matched] != '\0'; i++)
+    {
+        if (text[i] == ' ' || text[i] == '\t')
+        {
+            continue;
+        }
+        if (text[i] != keyword[matched])
+        {
+            break;
+        }
+        matched++;
+    }
+
+    return matched;
+}
+
+/*
+ * A definition or .include line is read and handled by process_line(), exactly like pre_proc() does.
+ * Any other line is only stepped over the way read_source_line() would read it:
+ * a whole line, or MAX_LINE_LENGTH - 1 characters of a longer one, whose rest
+ * process_line() skips unless the line has a comment error or a null character in it.
+ */
+void scan_macro_definitions(assembler_table **assembler, source_reader *source, long chunk_size,
+                            segment_list *segments, bool *final_error)
+{
+    char line[MAX_LINE_LENGTH], macro_name[MAX_LINE_LENGTH];
+    text_buffer body = {NULL, 0, 0};
+    source_segment current, output;
+    long line_end, piece_end;
+    size_t raw_length, length;
+    bool note_error;
+    int line_counter = 1;
+
+    memset(macro_name, '\0', MAX_LINE_LENGTH);
+
+    start_source_segment(&current, source, line_counter);
+
+    while (source->position < source->length)
+    {
+        line_end = source->line_starts[source->line + 1];
+        piece_end = line_end - source->position > MAX_LINE_LENGTH - 1 ? source->position + MAX_LINE_LENGTH - 1 : line_end;
+
+        if (handled_by_scan(source->text + source->position, piece_end - source->position))
+        {
+            current.end = source->position;
+            add_source_segment(segments, &current);
+
+            /* Only an included file writes text here */
+            start_source_segment(&output, source, line_counter);
+            output.output_start = (*assembler)->expanded_source.length;
+            output.first_call = (*assembler)->expansions.count;
+            output.first_output_line = (*assembler)->expansions.lines;
+
+            read_source_line(source, line);
+            process_line(line, assembler, source, NULL, macro_name, &body, &line_counter, final_error);
+            line_counter++;
+
+            output.output_length = (*assembler)->expanded_source.length - output.output_start;
+            output.call_count = (*assembler)->expansions.count - output.first_call;
+            output.output_lines = (*assembler)->expansions.lines - output.first_output_line;
+            add_source_segment(segments, &output);
+        }
+        else
+        {
+            if (piece_end == line_end)
+            {
+                skip_source_line(source);
+            }
+            else
+            {
+                /* Only a long line is cleaned here, to know if process_line() skips its rest */
+                read_source_line(source, line);
+                normalize_line(line, &raw_length, &length, &note_error);
+                if (!note_error && raw_length == MAX_LINE_LENGTH - 1)
+                {
+                    skip_source_line(source);
+                }
+            }
+            line_counter++;
+
+            if (source->position - current.start < chunk_size)
+            {
+                continue;
+            }
+
+            current.end = source->position;
+            add_source_segment(segments, &current);
+        }
+
+        start_source_segment(&current, source, line_counter);
+    }
+
+    current.end = source->position;
+    add_source_segment(segments, &current);
+
+    free_text_buffer(&body);
+}
+
+/*
+ * The segment has no text of the scan until it is given one.
+ */
+void start_source_segment(source_segment *segment, const source_reader *source, int line_number)
+{
+    segment->start = segment->end = source->position;
+    segment->first_index = source->line;
+    segment->first_line = line_number;
+    segment->output_start = segment->output_length = 0;
+    segment->first_call = segment->call_count = 0;
+    segment->first_output_line = segment->output_lines = 0;
+}
+
+/*
+ * Grows the list by doubling it.
+ */
+void add_source_segment(segment_list *segments, const source_segment *segment)
+{
+    source_segment *grown;
+
+    if (segment->end <= segment->start && segment->output_length == 0)
+    {
+        return;
+    }
+
+    if (segments->count == segments->capacity)
+    {
+        segments->capacity = segments->capacity == 0 ? 16 : segments->capacity * 2;
+        grown = my_malloc(sizeof(source_segment) * segments->capacity);
+        if (segments->items != NULL)
+        {
+            memcpy(grown, segments->items, sizeof(source_segment) * segments->count);
+            free(segments->items);
+        }
+        segments->items = grown;
+    }
+
+    segments->items[segments->count++] = *segment;
+}
+
+/*
+ * Every segment is read through a copy of the reader that ends with the segment.
+ * Its lines never start a definition or include a file, so process_line() only writes them
+ * or expands them. The text the scan wrote is copied as it is.
+ */
+void *expand_chunk(void *arg)
+{
+    preprocess_chunk *chunk = arg;
+    char line[MAX_LINE_LENGTH], macro_name[MAX_LINE_LENGTH];
+    text_buffer body = {NULL, 0, 0};
+    assembler_table *table = &chunk->table;
+    source_reader reader;
+    int i, line_counter;
+
+    memset(macro_name, '\0', MAX_LINE_LENGTH);
+    chunk->recorded = begin_recorded_diagnostics(&chunk->diagnostics);
+
+    for (i = 0; i < chunk->segment_count; i++)
+    {
+        if (chunk->segments[i].output_length > 0)
+        {
+            write_expanded_part(&table, NULL, chunk->scanned_text->text + chunk->segments[i].output_start,
+                                chunk->segments[i].output_length, chunk->scanned_calls->items + chunk->segments[i].first_call,
+                                chunk->segments[i].call_count, chunk->segments[i].first_output_line,
+                                chunk->segments[i].output_lines);
+            continue;
+        }
+
+        reader = *chunk->source;
+        reader.position = chunk->segments[i].start;
+        reader.line = chunk->segments[i].first_index;
+        reader.length = chunk->segments[i].end;
+        line_counter = chunk->segments[i].first_line;
+
+        while (read_source_line(&reader, line))
+        {
+            process_line(line, &table, &reader, NULL, macro_name, &body, &line_counter, &chunk->success);
+            line_counter++;
+        }
+    }
+
+    if (chunk->recorded)
+    {
+        end_buffered_diagnostics(&chunk->diagnostics);
+    }
+
+    free_text_buffer(&body);
+    return NULL;
+}
+
+/*
+ * The calls of the chunk move by the lines of the expanded source before it,
+ * and are matched by name to the macros of the file, so the nodes of the chunk can go.
+ */
+void join_chunk(assembler_table **assembler, am_writer *am, preprocess_chunk *chunk)
+{
+    write_expanded_part(assembler, am, chunk->table.expanded_source.text, chunk->table.expanded_source.length,
+                        chunk->table.expansions.items, chunk->table.expansions.count, 0, chunk->table.expansions.lines);
+    (*assembler)->error_count += chunk->table.error_count;
+
+    free(chunk->table.expansions.items);
+    free_text_buffer(&chunk->table.expanded_source);
+    free_arena(&chunk->table.macro_storage);
+    free_macro_index(&chunk->table.library_macros);
+}
+
+/*
+ * A definition and a chunk never share a line, and the messages of every part are in order,
+ * so merging them by line gives the order of the serial preprocessor.
+ */
+void print_chunk_diagnostics(diagnostic_record *definitions, preprocess_chunk *chunks, int chunk_count)
+{
+    diagnostic_record *record;
+    int i;
+
+    for (i = 0; i < chunk_count; i++)
+    {
+        if (!chunks[i].recorded)
+        {
+            continue;
+        }
+
+        for (record = chunks[i].diagnostics.records; record != NULL; record = record->next)
+        {
+            for (; definitions != NULL && definitions->line < record->line; definitions = definitions->next)
+            {
+                diagnostic_line(definitions->line);
+                diagnostic_printf("%s\n", definitions->message);
+            }
+
+            diagnostic_line(record->line);
+            diagnostic_printf("%s\n", record->message);
+        }
+    }
+
+    for (; definitions != NULL; definitions = definitions->next)
+    {
+        diagnostic_line(definitions->line);
+        diagnostic_printf("%s\n", definitions->message);
+    }
+}
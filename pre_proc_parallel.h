@@ -0,0 +1,161 @@
+#ifndef PRE_PROC_PARALLEL_H
+#define PRE_PROC_PARALLEL_H
+
+#include <pthread.h>
+#include "pre_proc.h"
+
+/* ============================ Parallel preprocessing ================================== */
+
+/*
+ * A large source is preprocessed in two phases. A fast scan goes over the lines
+ * and handles every macro definition and .include line the way pre_proc() does, in order,
+ * so the macros and their errors are the same. The lines between them are only counted
+ * and cut into segments, and the text an included file adds is a segment of its own.
+ * Then every thread expands a chunk of consecutive segments into an output of its own,
+ * and the chunks are joined in source order: the expanded text one after the other,
+ * and the macro calls moved by the number of lines of the chunks before them,
+ * so the .am file, the line numbers and the messages are exactly those of a serial run.
+ */
+
+/* Smallest part of a source given to one thread */
+#define PREPROCESS_CHUNK_MIN_SIZE 65536
+
+/* Lines of the source between two lines handled by the scan, or text the scan wrote */
+typedef struct source_segment
+{
+    long start;             /* Offset of the first line in the source */
+    long end;               /* Offset after the last line */
+    long first_index;       /* Index of the first line in the line index of the reader */
+    int first_line;         /* Line number of the first line */
+    long output_start;      /* For text the scan wrote: its offset in the output of the scan */
+    long output_length;     /* Its number of bytes, 0 for a segment of source lines */
+    long first_call;        /* Index of its first macro call in the calls of the scan */
+    long call_count;        /* Number of its macro calls */
+    long first_output_line; /* Number of lines the scan wrote before it */
+    long output_lines;      /* Number of its lines */
+} source_segment;
+
+/* The segments of a source, in order */
+typedef struct segment_list
+{
+    source_segment *items; /* The segments */
+    int count;             /* Number of segments */
+    int capacity;          /* Number of segments allocated */
+} segment_list;
+
+/* Consecutive segments expanded by one thread */
+typedef struct preprocess_chunk
+{
+    const source_reader *source;        /* The whole source, only read */
+    const text_buffer *scanned_text;    /* The text written by the scan */
+    const expansion_map *scanned_calls; /* The macro calls of that text */
+    const source_segment *segments;     /* The first segment of the chunk */
+    int segment_count;                  /* Number of segments */
+    assembler_table table;              /* Copy of the file's table with an output of its own */
+    bool success;                       /* false once a line had an error */
+    bool recorded;                      /* Whether the messages could be recorded */
+    diagnostics_buffer diagnostics;     /* The messages of the chunk */
+    bool started;                       /* Whether the chunk runs on a thread of its own */
+    pthread_t thread;                   /* The thread */
+} preprocess_chunk;
+
+/**
+ * Decides if a source is large enough to be preprocessed by several threads.
+ * With --max-errors the serial preprocessor is kept, since where it stops depends
+ * on every error before.
+ *
+ * @param assembler The table of the file.
+ * @param source The loaded source.
+ * @return true if parallel_pre_proc() should be used.
+ */
+bool parallel_preprocessing_wanted(const assembler_table *assembler, const source_reader *source);
+
+/**
+ * Preprocesses the whole source with several threads, with the result of pre_proc().
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param source The loaded source, at its start.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @return true if there were no errors, false otherwise.
+ */
+bool parallel_pre_proc(assembler_table **assembler, source_reader *source, am_writer *am);
+
+/**
+ * Checks if the part of a line read at once cleans to a line that starts a macro
+ * definition or includes a file, like normalize_line() returning LINE_MACRO_START
+ * or LINE_INCLUDE, without copying it.
+ *
+ * @param text The start of the part.
+ * @param length Number of characters of the part.
+ * @return true if the line starts with "mcro" (but not "mcroend") or ".include".
+ */
+bool handled_by_scan(const char *text, long length);
+
+/**
+ * Counts how many characters of a keyword the cleaned part of a line starts with.
+ *
+ * @param text The start of the part.
+ * @param length Number of characters of the part.
+ * @param keyword The keyword.
+ * @return The number of characters of the keyword that match.
+ */
+int cleaned_prefix_length(const char *text, long length, const char *keyword);
+
+/**
+ * First phase: handles the macro definitions and included files in order, and cuts the other
+ * lines into segments that end at such a line or after about chunk_size bytes.
+ * The text of the included files is written to the table, and a segment notes where.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param source The loaded source, at its start. Left at its end.
+ * @param chunk_size Size of the part of the source given to one thread.
+ * @param segments Receives the segments.
+ * @param final_error Set to false if a definition or an included file had an error.
+ */
+void scan_macro_definitions(assembler_table **assembler, source_reader *source, long chunk_size,
+                            segment_list *segments, bool *final_error);
+
+/**
+ * Starts a segment of source lines at the current line of the reader.
+ *
+ * @param segment The segment.
+ * @param source The reader.
+ * @param line_number The number of the current line.
+ */
+void start_source_segment(source_segment *segment, const source_reader *source, int line_number);
+
+/**
+ * Adds a segment to the list, unless it is empty.
+ *
+ * @param segments The list.
+ * @param segment The segment, with its end set.
+ */
+void add_source_segment(segment_list *segments, const source_segment *segment);
+
+/**
+ * Thread function of the second phase: expands the lines of the segments of a chunk.
+ *
+ * @param arg Pointer to the preprocess_chunk.
+ * @return Always NULL.
+ */
+void *expand_chunk(void *arg);
+
+/**
+ * Adds the output of a chunk after the output of the chunks before it.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param am Writer of the .am file, or NULL if the file is not kept.
+ * @param chunk The expanded chunk.
+ */
+void join_chunk(assembler_table **assembler, am_writer *am, preprocess_chunk *chunk);
+
+/**
+ * Prints the messages of the definitions and of the chunks in the order of their lines.
+ *
+ * @param definitions The messages of the first phase, or NULL if they were printed already.
+ * @param chunks The chunks.
+ * @param chunk_count Number of chunks.
+ */
+void print_chunk_diagnostics(diagnostic_record *definitions, preprocess_chunk *chunks, int chunk_count);
+
+#endif
@@ -10,7 +10,7 @@ bool validate_duplicate_labels(assembler_table **assembler)
     bool error = true;
 
     /* iterate over labels and compare each with the ones after it */
-    while (current != NULL)
+    while (current != NULL && !error_limit_reached(*assembler))
     {
         if (current->type != ENTRY)
         {
@@ -21,7 +21,8 @@ bool validate_duplicate_labels(assembler_table **assembler)
             {
                 if (strcmp(other->name, current->name) == 0 && other->type != ENTRY)
                 {
-                    printf("Error: Label '%s' is already defined.\n", current->name);
+                    diagnostic_printf("Error: Label '%s' is already defined.\n", current->name);
+                    (*assembler)->error_count++;
                     error = false;
                     break;
                 }
@@ -46,7 +47,7 @@ bool validate_entry_labels(assembler_table **assembler)
     bool found, error = true;
 
     /* iterate over label list and look for ENTRY labels */
-    while (entry != NULL)
+    while (entry != NULL && !error_limit_reached(*assembler))
     {
         if (entry->type == ENTRY)
         {
@@ -68,7 +69,8 @@ bool validate_entry_labels(assembler_table **assembler)
             /* if no match found, report error */
             if (!found)
             {
-                printf("Error: Entry label '%s' is undefined.\n", entry->name);
+                diagnostic_printf("Error: Entry label '%s' is undefined.\n", entry->name);
+                (*assembler)->error_count++;
                 error = false;
             }
         }
@@ -165,6 +167,35 @@ bool complement_ext_word(assembler_table **assembler, command *ptr_cmd)
 }
 
 
+/*
+  Looks the label up in the label list and in the external label list,
+  without changing any word (used by --check).
+*/
+bool is_label_defined(assembler_table **assembler, const char *name)
+{
+    label *ptr_label;
+    external_label *ptr_label_ex;
+
+    for (ptr_label = (*assembler)->label_list; ptr_label != NULL; ptr_label = ptr_label->next)
+    {
+        if (strcmp(name, ptr_label->name) == 0)
+        {
+            return true;
+        }
+    }
+
+    for (ptr_label_ex = (*assembler)->external_list; ptr_label_ex != NULL; ptr_label_ex = ptr_label_ex->next)
+    {
+        if (strcmp(name, ptr_label_ex->label) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
 /*
   Checks that no label is defined both as 'extern' and as a regular label.
   For every external label, searches the label list to ensure no duplicate exists.
@@ -176,7 +207,7 @@ bool check_if_label_defined_as_extern(assembler_table **assembler)
     bool error = true, duplicate_found;
 
     /* loop through all external labels */
-    while (ptr_label_ext != NULL)
+    while (ptr_label_ext != NULL && !error_limit_reached(*assembler))
     {
         ptr_label = (*assembler)->label_list;
         duplicate_found = false;
@@ -195,7 +226,8 @@ bool check_if_label_defined_as_extern(assembler_table **assembler)
         /* report error if a label is defined both as extern and regular */
         if (duplicate_found)
         {
-            printf("Error: Label '%s' is defined both as extern and entry.\n", ptr_label_ext->label);
+            diagnostic_printf("Error: Label '%s' is defined both as extern and entry.\n", ptr_label_ext->label);
+            (*assembler)->error_count++;
             error = false;
         }
 
@@ -217,18 +249,29 @@ bool resolve_label_references(assembler_table **assembler)
     bool success = true;
 
     /* go over each command and resolve its referenced label if exists */
-    while (ptr_cmd != NULL)
+    while (ptr_cmd != NULL && !error_limit_reached(*assembler))
     {
         if (ptr_cmd->referenced_label[0] != '\0')
         {
+            /* a check only needs to know the label exists */
+            if ((*assembler)->options->check_only)
+            {
+                if (!is_label_defined(assembler, ptr_cmd->referenced_label))
+                {
+                    success = false;
+                    diagnostic_printf("Error: Undefined label '%s'\n", ptr_cmd->referenced_label);
+                    (*assembler)->error_count++;
+                }
+            }
             /* try to complete internal label first */
-            if (!complement_label_word(assembler, ptr_cmd))
+            else if (!complement_label_word(assembler, ptr_cmd))
             {
                 /* if not found, try external label */
                 if (!complement_ext_word(assembler, ptr_cmd))
                 {
                     success = false;
-                    printf("Error: Undefined label '%s'\n", ptr_cmd->referenced_label);
+                    diagnostic_printf("Error: Undefined label '%s'\n", ptr_cmd->referenced_label);
+                    (*assembler)->error_count++;
                 }
             }
         }
@@ -244,6 +287,7 @@ bool resolve_label_references(assembler_table **assembler)
  * Executes the full second pass of the assembler:
  * Verifies label consistency, resolves label references,
  * and reports any undefined labels.
+ * Every check stops once the file reached the --max-errors limit.
  */
 bool second_pass(assembler_table **assembler)
 {
@@ -256,13 +300,13 @@ bool second_pass(assembler_table **assembler)
     }
 
     /* check that labels marked as extern are not defined locally */
-    if (!check_if_label_defined_as_extern(assembler))
+    if (!error_limit_reached(*assembler) && !check_if_label_defined_as_extern(assembler))
     {
         final_error = false;
     }
 
     /* resolve label references in the code section */
-    if (!resolve_label_references(assembler))
+    if (!error_limit_reached(*assembler) && !resolve_label_references(assembler))
     {
         final_error = false;
     }
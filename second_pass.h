@@ -38,6 +38,16 @@ bool complement_label_word(assembler_table **assembler, command *ptr_cmd);
  */
 bool complement_ext_word(assembler_table **assembler, command *ptr_cmd);
 
+/**
+ * Checks if a referenced label is defined, internally or as external,
+ * without completing any word or recording a usage. Used by --check.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param name The referenced label.
+ * @return True if the label was found, false otherwise.
+ */
+bool is_label_defined(assembler_table **assembler, const char *name);
+
 
 /* ======================= Functions of error handling========================================= */
 
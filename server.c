@@ -0,0 +1,325 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+/*
+ * Opens a UNIX socket and sets its address to the given path.
+ * Returns the socket, or -1 if the path is too long or the socket can't be created.
+ */
+static int open_unix_socket(const char *socket_path, struct sockaddr_un *address)
+{
+    if (strlen(socket_path) >= sizeof(address->sun_path))
+    {
+        printf("Error: Socket path is too long.\n");
+        return -1;
+    }
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    strcpy(address->sun_path, socket_path);
+
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+}
+
+/*
+ * Checks that "<filename>.as" can be opened.
+ * my_fopen() exits on failure, which would take the whole daemon down,
+ * so the server checks first and reports the error to the client instead.
+ */
+static bool source_exists(char *filename)
+{
+    char path[MAX_LINE_LENGTH];
+    FILE *fp;
+
+    if (strlen(filename) > MAX_LABEL_LENGTH)
+    {
+        return true; /* process_file_in_table() reports the long name */
+    }
+
+    add_ending_to_string(path, filename, ".as");
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        return false;
+    }
+
+    fclose(fp);
+    return true;
+}
+
+/*
+ * Assembles one file and sends its diagnostics, output files and status.
+ * A fatal error while assembling jumps back here like in the library (see libassembler.c),
+ * so it ends the file with "STATUS fatal" instead of the daemon.
+ */
+void serve_file(FILE *response, assembler_table *assembler, char *filename)
+{
+    const char *endings[] = {".am", ".ob", ".ent", ".ext"};
+    int endings_len = sizeof(endings) / sizeof(endings[0]);
+    diagnostics_buffer diagnostics;
+    char output[MAX_LINE_LENGTH];
+    const char *status;
+    jmp_buf recovery;
+    bool buffered;
+    FILE *fp;
+    int i;
+
+    buffered = begin_buffered_diagnostics(&diagnostics);
+    set_fatal_recovery(&recovery);
+
+    if (setjmp(recovery) != 0)
+    {
+        /* The table may be left in the middle of the file */
+        abandon_pre_proc(assembler);
+        reset_assembler_table(assembler, "");
+        status = "fatal";
+    }
+    else if (!source_exists(filename))
+    {
+        errors_table(FAILED_TO_OPEN_FILE, -1);
+        status = "fatal";
+    }
+    else if (process_file_in_table(assembler, filename))
+    {
+        status = "ok";
+    }
+    else
+    {
+        diagnostic_printf("Error processing file: %s\n", filename);
+        status = "failed";
+    }
+
+    set_fatal_recovery(NULL);
+
+    if (buffered)
+    {
+        end_buffered_diagnostics(&diagnostics);
+        fprintf(response, "DIAGNOSTICS %lu\n", (unsigned long)diagnostics.size);
+        fwrite(diagnostics.text, 1, diagnostics.size, response);
+        free(diagnostics.text);
+    }
+    else
+    {
+        fprintf(response, "DIAGNOSTICS 0\n");
+    }
+
+    /* Reports the output files the client can find in its directory */
+    for (i = 0; i < endings_len && strlen(filename) <= MAX_LABEL_LENGTH; i++)
+    {
+        add_ending_to_string(output, filename, endings[i]);
+        fp = fopen(output, "r");
+        if (fp != NULL)
+        {
+            fclose(fp);
+            fprintf(response, "OUTPUT %s\n", output);
+        }
+    }
+
+    fprintf(response, "STATUS %s\n", status);
+    fflush(response);
+}
+
+/*
+ * Reads "DIR", "FILE" and "END" lines from the client, and answers every file.
+ * Files are resolved against the client's directory, like in the command line assembler.
+ */
+void serve_client(int connection, assembler_table *assembler)
+{
+    char line[MAX_REQUEST_LINE];
+    FILE *request, *response;
+    int reply = dup(connection);
+
+    request = fdopen(connection, "r");
+    response = reply == -1 ? NULL : fdopen(reply, "w");
+    if (request == NULL || response == NULL)
+    {
+        if (request != NULL)
+            fclose(request);
+        else
+            close(connection);
+        if (reply != -1)
+            close(reply);
+        return;
+    }
+
+    while (fgets(line, sizeof(line), request) != NULL)
+    {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (strncmp(line, "DIR ", strlen("DIR ")) == 0)
+        {
+            if (chdir(line + strlen("DIR ")) != 0)
+            {
+                fprintf(response, "DIAGNOSTICS 0\nSTATUS fatal\n");
+                break;
+            }
+        }
+        else if (strncmp(line, "FILE ", strlen("FILE ")) == 0)
+        {
+            serve_file(response, assembler, line + strlen("FILE "));
+        }
+        else if (strcmp(line, "END") == 0)
+        {
+            break;
+        }
+    }
+
+    fclose(request);
+    fclose(response);
+}
+
+/*
+ * Creates the socket and serves the clients one after the other.
+ * Requests are handled in order because each one changes the working directory.
+ */
+int run_server(const char *socket_path)
+{
+    struct sockaddr_un address;
+    assembler_table *assembler;
+    struct stat existing;
+    int listener, connection;
+
+    /* Only a socket may be replaced; any other file at the path was given by mistake */
+    if (lstat(socket_path, &existing) == 0 && !S_ISSOCK(existing.st_mode))
+    {
+        printf("Error: %s exists and is not a socket.\n", socket_path);
+        return 1;
+    }
+
+    listener = open_unix_socket(socket_path, &address);
+    if (listener == -1)
+    {
+        printf("Error: Failed to create the server socket.\n");
+        return 1;
+    }
+
+    /* A socket left behind by a previous server would make bind() fail */
+    if (lstat(socket_path, &existing) == 0 && S_ISSOCK(existing.st_mode))
+    {
+        unlink(socket_path);
+    }
+
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+    {
+        printf("Error: Failed to listen on %s\n", socket_path);
+        close(listener);
+        return 1;
+    }
+
+    /* A client that disconnects early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Neither may a source that is truncated while it is assembled */
+    set_source_mapping(false);
+
+    /* The table stays allocated for the lifetime of the server */
+    assembler = initialize_assembler_table("");
+
+    while (true)
+    {
+        connection = accept(listener, NULL, NULL);
+        if (connection == -1)
+        {
+            continue;
+        }
+
+        serve_client(connection, assembler);
+    }
+
+    free_assembler_table(assembler);
+    close(listener);
+    unlink(socket_path);
+
+    return 0;
+}
+
+/*
+ * Sends the request, then prints every diagnostics block it receives.
+ * A "fatal" status ends the client with exit code 1, like my_fopen() ends the assembler,
+ * and so does a connection that closes before every file got its status.
+ */
+int run_client(const char *socket_path, char **files, int file_count)
+{
+    struct sockaddr_un address;
+    char line[MAX_REQUEST_LINE], chunk[MAX_LINE_LENGTH];
+    char directory[MAX_REQUEST_LINE - 8];
+    unsigned long remaining;
+    size_t size;
+    FILE *request, *response;
+    int connection, i, statuses = 0, result = 0;
+
+    connection = open_unix_socket(socket_path, &address);
+    if (connection == -1 || connect(connection, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        printf("Error: Failed to connect to the assembler server at %s\n", socket_path);
+        if (connection != -1)
+            close(connection);
+        return 1;
+    }
+
+    if (getcwd(directory, sizeof(directory)) == NULL)
+    {
+        printf("Error: Failed to read the working directory.\n");
+        close(connection);
+        return 1;
+    }
+
+    request = fdopen(dup(connection), "w");
+    response = fdopen(connection, "r");
+    if (request == NULL || response == NULL)
+    {
+        printf("Error: Failed to connect to the assembler server at %s\n", socket_path);
+        return 1;
+    }
+
+    fprintf(request, "DIR %s\n", directory);
+    for (i = 0; i < file_count; i++)
+    {
+        fprintf(request, "FILE %s\n", files[i]);
+    }
+    fprintf(request, "END\n");
+    fflush(request);
+
+    while (fgets(line, sizeof(line), response) != NULL)
+    {
+        if (sscanf(line, "DIAGNOSTICS %lu", &remaining) == 1)
+        {
+            /* Copies the messages to stdout as they are */
+            while (remaining > 0)
+            {
+                size = fread(chunk, 1, remaining < sizeof(chunk) ? remaining : sizeof(chunk), response);
+                if (size == 0)
+                    break;
+                fwrite(chunk, 1, size, stdout);
+                remaining -= size;
+            }
+        }
+        else if (strcmp(line, "STATUS fatal\n") == 0)
+        {
+            result = 1;
+            break;
+        }
+        else if (strncmp(line, "STATUS ", strlen("STATUS ")) == 0)
+        {
+            statuses++;
+        }
+    }
+
+    if (result == 0 && statuses < file_count)
+    {
+        printf("Error: The assembler server closed the connection before answering every file.\n");
+        result = 1;
+    }
+
+    fclose(request);
+    fclose(response);
+
+    return result;
+}
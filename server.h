@@ -0,0 +1,64 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdio.h>
+#include "assembler.h"
+
+/* ============================ Assembler daemon ================================== */
+
+/*
+ * The server listens on a UNIX domain socket and assembles files for its clients,
+ * keeping one warm assembler table between requests.
+ *
+ * Request (client -> server), one line each:
+ *     DIR <working directory of the client>
+ *     FILE <file name without extension>     (any number of times)
+ *     END
+ *
+ * Response (server -> client), for every file:
+ *     DIAGNOSTICS <n>        followed by exactly n bytes of messages
+ *     OUTPUT <path>          for every output file that was written
+ *     STATUS ok | failed | fatal
+ */
+
+/* Maximum length of a protocol line (a working directory can be long) */
+#define MAX_REQUEST_LINE 4200
+
+/**
+ * Runs the assembler daemon on the given socket path until it is killed.
+ *
+ * @param socket_path Path of the UNIX domain socket to create.
+ * @return 0 on a clean exit, 1 if the socket could not be set up.
+ */
+int run_server(const char *socket_path);
+
+/**
+ * Handles one connection: reads the request, assembles the files and sends the results.
+ *
+ * @param connection The connected socket.
+ * @param assembler The warm table reused for every file.
+ */
+void serve_client(int connection, assembler_table *assembler);
+
+/**
+ * Assembles one requested file, and writes its response block.
+ *
+ * @param response The stream to the client.
+ * @param assembler The warm table.
+ * @param filename The requested file (without extension).
+ */
+void serve_file(FILE *response, assembler_table *assembler, char *filename);
+
+/**
+ * Thin client: sends the files to a running server and prints its answers
+ * exactly like the command line assembler would.
+ *
+ * @param socket_path Path of the server's socket.
+ * @param files The files to assemble.
+ * @param file_count Number of files.
+ * @return 0 on success, 1 if the server could not be reached, reported a fatal error,
+ *         or closed the connection before answering every file.
+ */
+int run_client(const char *socket_path, char **files, int file_count);
+
+#endif /* SERVER_H */
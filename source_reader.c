@@ -0,0 +1,152 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "assembler.h"
+
+/* Size of the reads of a source that can't be mapped */
+#define SOURCE_READ_CHUNK 4096
+
+/* Whether regular files may be mapped (see set_source_mapping()) */
+static bool mapping_enabled = true;
+
+/*
+ * Set once, before any file is read.
+ */
+void set_source_mapping(bool enabled)
+{
+    mapping_enabled = enabled;
+}
+
+/*
+ * Maps a regular file read-only. Pipes, memory streams and empty files
+ * are read into a buffer instead, which is what the reader then owns.
+ * The newlines are found with memchr(), which scans many bytes per step.
+ */
+void open_source_reader(source_reader *source, FILE *fp)
+{
+    struct stat info;
+    text_buffer buffer = {NULL, 0, 0};
+    char chunk[SOURCE_READ_CHUNK];
+    long capacity = 64, offset = 0, count = 0;
+    size_t read;
+    const char *newline;
+    long *grown;
+
+    source->mapping = NULL;
+
+    /* Only from the start of the file, a stream may have been read from already */
+    if (mapping_enabled && fileno(fp) >= 0 && fstat(fileno(fp), &info) == 0 && S_ISREG(info.st_mode) &&
+        info.st_size > 0 && ftell(fp) == 0)
+    {
+        source->mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (source->mapping == MAP_FAILED)
+        {
+            source->mapping = NULL;
+        }
+    }
+
+    if (source->mapping != NULL)
+    {
+        posix_madvise(source->mapping, info.st_size, POSIX_MADV_SEQUENTIAL);
+        source->text = source->mapping;
+        source->length = info.st_size;
+    }
+    else
+    {
+        while ((read = fread(chunk, 1, SOURCE_READ_CHUNK, fp)) > 0)
+        {
+            append_to_text_buffer(&buffer, chunk, read);
+        }
+        source->text = buffer.text;
+        source->length = buffer.length;
+    }
+
+    /* The start of every line, and the end of the source after the last one */
+    source->line_starts = my_malloc(sizeof(long) * capacity);
+    while (offset < source->length)
+    {
+        if (count + 2 > capacity)
+        {
+            capacity *= 2;
+            grown = my_malloc(sizeof(long) * capacity);
+            memcpy(grown, source->line_starts, sizeof(long) * count);
+            free(source->line_starts);
+            source->line_starts = grown;
+        }
+
+        source->line_starts[count++] = offset;
+        newline = memchr(source->text + offset, '\n', source->length - offset);
+        offset = newline != NULL ? newline - source->text + 1 : source->length;
+    }
+    source->line_starts[count] = source->length;
+
+    source->line_count = count;
+    source->line = 0;
+    source->position = 0;
+}
+
+/*
+ * Copies the rest of the current line, at most MAX_LINE_LENGTH - 1 characters.
+ * The end of the line comes from the index, so the line isn't scanned again.
+ */
+bool read_source_line(source_reader *source, char line[MAX_LINE_LENGTH])
+{
+    long end, length;
+
+    if (source->position >= source->length)
+    {
+        line[0] = '\0';
+        return false;
+    }
+
+    end = source->line_starts[source->line + 1];
+    length = end - source->position;
+    if (length > MAX_LINE_LENGTH - 1)
+    {
+        length = MAX_LINE_LENGTH - 1; /* The rest is read as the next line, like fgets() does */
+    }
+
+    memcpy(line, source->text + source->position, length);
+    line[length] = '\0';
+
+    source->position += length;
+    if (source->position == end)
+    {
+        source->line++;
+    }
+
+    return true;
+}
+
+/*
+ * Moves to the start of the next line.
+ */
+void skip_source_line(source_reader *source)
+{
+    if (source->position < source->length)
+    {
+        source->position = source->line_starts[++source->line];
+    }
+}
+
+/*
+ * Releases the source and the line index.
+ */
+void close_source_reader(source_reader *source)
+{
+    if (source->mapping != NULL)
+    {
+        munmap(source->mapping, source->length);
+    }
+    else
+    {
+        free((char *)source->text);
+    }
+
+    free(source->line_starts);
+    source->text = NULL;
+    source->line_starts = NULL;
+    source->mapping = NULL;
+}
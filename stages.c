@@ -0,0 +1,85 @@
+#include "assembler.h"
+
+/*
+* Runs all the stages of the assembly on an existing table.
+* The table is reset before and after the file, so it can be reused for the next one.
+*/
+bool run_assembly_stages(assembler_table *assembler, char *filename)
+{
+    bool success = false;
+
+    if (preprocess_stage(assembler, filename) && passes_stage(assembler, filename))
+    {
+        /* Generate final output files */
+        output_stage(assembler);
+        success = true;
+    }
+
+    /* Release the lists of this file, but keep the table itself */
+    reset_assembler_table(assembler, filename);
+
+    return success;
+}
+
+/*
+* Resets the table for the file and runs the preprocessor.
+*/
+bool preprocess_stage(assembler_table *assembler, char *filename)
+{
+    reset_assembler_table(assembler, filename);
+
+    /* Run preprocessor */
+    if (!pre_proc(&assembler))
+    {
+        report_error_limit(assembler);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+* Runs the first and the second pass on the expanded source.
+*/
+bool passes_stage(assembler_table *assembler, char *filename)
+{
+    /* Run first pass */
+    if (!first_pass(filename, assembler))
+    {
+        first_pass_errors(ERR_FIRST_PASS, -1, -1);
+        report_error_limit(assembler);
+        return false;
+    }
+
+    /* Run second pass */
+    if (!second_pass(&assembler))
+    {
+        report_error_limit(assembler);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+* Tells the user that a failed stage stopped early because of --max-errors.
+*/
+void report_error_limit(assembler_table *assembler)
+{
+    if (error_limit_reached(assembler))
+    {
+        errors_table(TOO_MANY_ERRORS, -1);
+    }
+}
+
+/*
+* Writes the output files of a file that passed both passes.
+*/
+void output_stage(assembler_table *assembler)
+{
+    /* A check has nothing to write */
+    if (!assembler->options->check_only)
+    {
+        translation_unit(assembler);
+    }
+}
@@ -1,5 +1,8 @@
 #include "assembler.h"
 
+/* The options given on the command line (main() fills them before any file is processed) */
+assembler_options default_options = {false, false, 0, false, 1, NULL, false};
+
 /* Initialize assembler_table struct with default values.
    Allocates memory and sets all lists and counters to NULL/0.
    Copies the source file name (argv) into the struct. */
@@ -10,14 +13,111 @@ assembler_table * initialize_assembler_table(char * argv){
     assembler->label_list = NULL;            /* Initialize label list pointer */
     assembler->external_list = NULL;         /* Initialize external label list */
     assembler->macro_list = NULL;            /* Initialize macro list */
+    assembler->macros.slots = NULL;          /* The macro index is allocated with the first macro */
+    assembler->macros.capacity = 0;
+    assembler->macros.count = 0;
+    assembler->library_macros.slots = NULL;  /* So is the index of the library macros */
+    assembler->library_macros.capacity = 0;
+    assembler->library_macros.count = 0;
+    assembler->macro_storage.blocks = NULL;  /* The macro arena gets its first block with the first macro */
+    assembler->expansions.items = NULL;      /* No macro calls yet */
+    assembler->expansions.count = 0;
+    assembler->expansions.capacity = 0;
+    assembler->expansions.lines = 0;
     strcpy(assembler->source_file , argv);  /* Copy source file name (no extension handling here) */
     memset( assembler->macro_expanded_file, 0, sizeof( assembler->macro_expanded_file)); /* Clear macro expanded file string */
     memset( assembler->assembly_file, 0, sizeof( assembler->assembly_file));              /* Clear assembly file string */
     assembler->instruction_counter = 0 ;     /* Reset instruction counter */
     assembler->data_counter = 0;              /* Reset data counter */
+    assembler->error_count = 0;               /* No errors yet */
+    assembler->expanded_source.text = NULL;  /* No expanded source yet */
+    assembler->expanded_source.length = 0;
+    assembler->expanded_source.capacity = 0;
+    assembler->options = &default_options;   /* Command line options by default */
+    assembler->source_stream = NULL;         /* Read the .as file */
+    assembler->includer = NULL;              /* Not included by another file */
+    assembler->open_source = NULL;           /* Not preprocessing yet */
+    assembler->open_am = NULL;
     return assembler;                        /* Return pointer to initialized assembler_table */
 }
 
+/* Reset an existing assembler_table for a new source file.
+   Frees every list of the previous file, then clears the struct
+   the same way initialize_assembler_table() does. */
+void reset_assembler_table(assembler_table * table, char * argv){
+    free_data_section(table->data_section);      /* Free previous data section */
+    free_code_section(table->code_section);      /* Free previous code section */
+    free_label_list(table->label_list);          /* Free previous labels */
+    free_external_list(table->external_list);    /* Free previous external labels */
+    reset_arena(&table->macro_storage);          /* Free previous macros, keep a block of the arena */
+    clear_macro_index(&table->macros);           /* Keep the index slots for the next file */
+    clear_macro_index(&table->library_macros);
+    table->data_section = NULL;
+    table->code_section = NULL;
+    table->label_list = NULL;
+    table->external_list = NULL;
+    table->macro_list = NULL;
+    strcpy(table->source_file , argv);          /* Copy the new source file name */
+    memset( table->macro_expanded_file, 0, sizeof( table->macro_expanded_file));
+    memset( table->assembly_file, 0, sizeof( table->assembly_file));
+    table->instruction_counter = 0 ;
+    table->data_counter = 0;
+    table->error_count = 0;
+    table->expanded_source.length = 0;          /* Keep the buffer for the next file */
+    table->expansions.count = 0;                /* Keep the calls array too */
+    table->expansions.lines = 0;
+}
+
+/* Append text to a text buffer.
+   The buffer starts at 1KB and doubles whenever the text doesn't fit. */
+void append_to_text_buffer(text_buffer * buffer, const char * text, long length){
+    char * grown;
+
+    if(length == 0){
+        return;                                  /* Nothing to copy, and the text may still be NULL */
+    }
+
+    if(buffer->length + length > buffer->capacity){
+        long capacity = buffer->capacity == 0 ? 1024 : buffer->capacity;
+
+        while(buffer->length + length > capacity){
+            capacity *= 2;
+        }
+
+        grown = my_malloc(capacity);
+        if(buffer->text != NULL){
+            memcpy(grown, buffer->text, buffer->length); /* Keep the text so far */
+            free(buffer->text);
+        }
+        buffer->text = grown;
+        buffer->capacity = capacity;
+    }
+
+    memcpy(buffer->text + buffer->length, text, length);
+    buffer->length += length;
+}
+
+/* Read the next line of a text buffer into 'line', like fgets() does with a file.
+   Stops after a '\n' or when MAX_LINE_LENGTH - 1 characters were copied. */
+bool read_text_buffer_line(text_buffer * buffer, long * position, char line[MAX_LINE_LENGTH]){
+    int i = 0;
+
+    if(*position >= buffer->length){
+        return false;                        /* Nothing left */
+    }
+
+    while(*position < buffer->length && i < MAX_LINE_LENGTH - 1){
+        line[i] = buffer->text[*position];
+        (*position)++;
+        if(line[i++] == '\n'){
+            break;                           /* End of the line */
+        }
+    }
+
+    line[i] = '\0';
+    return true;
+}
+
 /* Add a new external_usage node with given address to the linked list.
    If the list is empty, create the first node.
    Otherwise, traverse to the end and append the new node. */
@@ -41,51 +141,127 @@ void add_to_external_usage(external_usage ** usage_list , int address){
     temp->next = new_node;  /* Append the new node */
 }
 
-/* Add a new macro node with the given name and content to the macro list.
-   If list is empty, start it with the new macro.
-   Otherwise, append to the end. */
-void add_to_macro_list(macro ** head , char * macro_name , macro_content * content){
-    macro * temp;
-    macro * new_macro = my_malloc(sizeof(macro));
+/* Add a new macro with the given name and body to the macro list,
+   and to the macro index, which is what finds it again.
+   The node and a copy of the body are taken from the macro arena,
+   and the body is copied at once, then its lines are counted.
+   Since the list is only walked to free it, the new macro goes first. */
+void add_to_macro_list(assembler_table * assembler , char * macro_name , text_buffer * body){
+    size_t length;
+    macro * new_macro = arena_alloc(&assembler->macro_storage, sizeof(macro));
     strcpy(new_macro->macro_name , macro_name); /* Copy macro name */
-    new_macro->content = content;                /* Attach macro content */
-    new_macro->next = NULL;                       /* New macro is last */
+    new_macro->hash = hash_macro_name(macro_name, &length);
 
-    if( *head == NULL){
-        *head = new_macro;   /* Empty list case */
-        return;
-    } 
+    new_macro->body = arena_alloc(&assembler->macro_storage, body->length);
+    if(body->length > 0){
+        memcpy(new_macro->body, body->text, body->length);
+    }
+    new_macro->body_length = body->length;
+    new_macro->line_count = count_body_lines(new_macro->body, new_macro->body_length);
+    new_macro->compiled = NULL;                  /* Compiled by the first pass */
+    new_macro->defined_line = 0;                 /* Set by the preprocessor for a "mcro" of the source */
+    new_macro->parameter_count = 0;              /* Set with the slots of a parameterized macro */
+    new_macro->slots = NULL;
+    new_macro->slot_count = 0;
 
-    temp = *head;
+    new_macro->next = assembler->macro_list;     /* Push to the front */
+    assembler->macro_list = new_macro;
 
-    /* Traverse to end */
-    while(temp->next != NULL){
-        temp = temp->next;
+    add_to_macro_index(&assembler->macros, new_macro);
+}
+
+/* Insert a macro into the index with linear probing.
+   The slots are doubled (and every macro placed again) before they are half full,
+   so the probe sequences stay short. */
+void add_to_macro_index(macro_index * index , macro * new_macro){
+    long slot;
+
+    if((index->count + 1) * 2 > index->capacity){
+        macro ** old_slots = index->slots;
+        long old_capacity = index->capacity, i;
+        long capacity = old_capacity == 0 ? MACRO_INDEX_INITIAL_SIZE : old_capacity * 2;
+        macro ** slots = my_malloc(sizeof(macro *) * capacity);  /* The index stays whole if this fails */
+
+        memset(slots, 0, sizeof(macro *) * capacity);
+        index->slots = slots;
+        index->capacity = capacity;
+        index->count = 0;
+
+        for(i = 0; i < old_capacity; i++){
+            if(old_slots[i] != NULL){
+                add_to_macro_index(index, old_slots[i]);
+            }
+        }
+        free(old_slots);
     }
 
-    temp->next = new_macro;  /* Append new macro */
+    /* Find the first free slot from the home slot */
+    slot = new_macro->hash & (index->capacity - 1);
+    while(index->slots[slot] != NULL){
+        slot = (slot + 1) & (index->capacity - 1);
+    }
+
+    index->slots[slot] = new_macro;
+    index->count++;
 }
 
-/* Add a new macro_content node with the given content line to the content list.
-   If the list is empty, start it with the new node.
-   Otherwise, append it to the end. */
-void add_to_content_list(macro_content ** head ,char * content ){
-    macro_content * temp;
-    macro_content * new_content_node = my_malloc(sizeof(macro_content));
-    strcpy(new_content_node->content_line , content); /* Copy content line */
-    new_content_node->next = NULL;                      /* New content is last */
-
-    if( *head == NULL){
-        *head = new_content_node; /* Empty list case */
-        return;
-    } 
+/* Add a macro call to the expansion map. The array doubles when it is full. */
+void add_macro_expansion(expansion_map * map , macro * source){
+    macro_expansion * grown;
 
-    temp = *head;
+    if(map->count == map->capacity){
+        long capacity = map->capacity == 0 ? 64 : map->capacity * 2;
 
-    /* Traverse to end */
-    while(temp->next != NULL){
-        temp = temp->next;
+        grown = my_malloc(sizeof(macro_expansion) * capacity);  /* The map stays whole if this fails */
+        if(map->items != NULL){
+            memcpy(grown, map->items, sizeof(macro_expansion) * map->count); /* Keep the calls so far */
+            free(map->items);
+        }
+        map->items = grown;
+        map->capacity = capacity;
     }
 
-    temp->next = new_content_node; /* Append new content */
+    map->items[map->count].first_line = map->lines + 1;
+    map->items[map->count].source = source;
+    map->count++;
+    map->lines += source->line_count;
+}
+
+/* Hand out the next bytes of the current block of an arena.
+   A new block is taken when they don't fit, at least ARENA_BLOCK_SIZE bytes. */
+void * arena_alloc(arena * storage , long size){
+    arena_block * block = storage->blocks;
+    void * memory;
+
+    /* Keep every allocation aligned for pointers and longs */
+    size = (size + sizeof(long) - 1) / sizeof(long) * sizeof(long);
+
+    if(block == NULL || block->used + size > block->size){
+        long block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+        block = my_malloc(sizeof(arena_block) + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = storage->blocks;
+        storage->blocks = block;
+    }
+
+    memory = (char *)(block + 1) + block->used; /* The bytes follow the block header */
+    block->used += size;
+    return memory;
+}
+
+/* Free every block but the oldest, and empty that one for the next file. */
+void reset_arena(arena * storage){
+    arena_block * tmp;
+
+    while(storage->blocks != NULL && storage->blocks->next != NULL){
+        tmp = storage->blocks;
+        storage->blocks = tmp->next;
+        free(tmp);
+    }
+
+    if(storage->blocks != NULL){
+        storage->blocks->used = 0;
+    }
 }
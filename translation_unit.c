@@ -67,8 +67,6 @@ void translate_ic_dc(int number, char dest[])
 void object_file(assembler_table *assembler)
 {
   char file_object[MAX_LABEL_LENGTH] = {0};
-  char ic_dest[MAX_LABEL_LENGTH] = {0};
-  char dc_dest[MAX_LABEL_LENGTH] = {0};
   FILE *fp_ob = NULL;
 
   /* Open the .ob file for writing */
@@ -77,21 +75,30 @@ void object_file(assembler_table *assembler)
     return;
   }
 
+  write_object_image(assembler, fp_ob);
+
+  /* Close the file */
+  fclose(fp_ob);
+}
+
+/*
+ * Writes the IC/DC header line, then the code and data sections.
+ */
+void write_object_image(assembler_table *assembler, FILE *fp_ob)
+{
+  char ic_dest[MAX_LABEL_LENGTH] = {0};
+  char dc_dest[MAX_LABEL_LENGTH] = {0};
+
   /* Convert IC and DC to base-4 format */
   translate_ic_dc(assembler->instruction_counter - 100, ic_dest);
   translate_ic_dc(assembler->data_counter, dc_dest);
 
- 
-
   /* Write IC and DC values to the first line */
   fprintf(fp_ob, "\t%s\t%s\n", ic_dest, dc_dest);
 
   /* Write machine code and data sections */
   write_code_section(assembler->code_section, fp_ob);
   write_data_section(assembler->data_section, assembler->instruction_counter, fp_ob);
-
-  /* Close the file */
-  fclose(fp_ob);
 }
 
 /*
@@ -343,7 +350,74 @@ void ent_file(assembler_table *assembler)
 */
 void translation_unit(assembler_table *assembler)
 {
+  if (assembler->options->use_stdio)
+  {
+    stream_output(assembler, stdout);
+    return;
+  }
+
   object_file(assembler);  /* Write machine code and data to .ob */
   ent_file(assembler);     /* Write entry labels to .ent */
   ext_file(assembler);     /* Write external usages to .ext */
 }
+
+/*
+ * Writes everything to one stream. Each section starts with a line holding
+ * the ending of the file it replaces, and like the files, empty .ent and .ext
+ * sections are left out.
+ */
+void stream_output(assembler_table *assembler, FILE *fp_out)
+{
+  fprintf(fp_out, ".ob\n");
+  write_object_image(assembler, fp_out);
+
+  if (has_entry_labels(assembler->label_list))
+  {
+    fprintf(fp_out, ".ent\n");
+    write_entry_labels(assembler->label_list, fp_out);
+  }
+
+  if (has_extern_usages(assembler->external_list))
+  {
+    fprintf(fp_out, ".ext\n");
+    write_extern_usages(assembler->external_list, fp_out);
+  }
+
+  fflush(fp_out);
+}
+
+/*
+ * Returns true if any label is marked as ENTRY.
+ */
+bool has_entry_labels(label *label_list)
+{
+  label *temp;
+
+  for (temp = label_list; temp != NULL; temp = temp->next)
+  {
+    if (temp->type == ENTRY)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+ * Returns true if any external label was used.
+ */
+bool has_extern_usages(external_label *ext_list)
+{
+  external_label *ext;
+
+  for (ext = ext_list; ext != NULL; ext = ext->next)
+  {
+    if (ext->usage_list != NULL)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
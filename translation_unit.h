@@ -29,6 +29,15 @@ void ent_file(assembler_table *assembler);
  */
 void ext_file(assembler_table *assembler);
 
+/**
+ * Writes the object image, the entries and the externals to one stream,
+ * each section after a ".ob", ".ent" or ".ext" line. Used when assembling to stdout.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param fp_out The output stream.
+ */
+void stream_output(assembler_table *assembler, FILE *fp_out);
+
 
 /* ========== Helper methods for open files ========== */
 
@@ -65,6 +74,14 @@ bool open_extern_file(const char *source_filename, char *file_external, FILE **f
 
 /* ========== Write section functions ========== */
 
+/**
+ * Writes the contents of the .ob file: the IC and DC line, then the code and data sections.
+ *
+ * @param assembler Pointer to the assembler table.
+ * @param fp_ob File pointer to write to.
+ */
+void write_object_image(assembler_table *assembler, FILE *fp_ob);
+
 /**
  * Writes the command section to the .ob file.
  *
@@ -101,6 +118,22 @@ bool write_extern_usages(external_label *ext_list, FILE *fp_ext);
  */
 bool write_entry_labels(label *label_list, FILE *fp_ent);
 
+/**
+ * Checks if any label is an ENTRY label.
+ *
+ * @param label_list List of labels.
+ * @return True if at least one ENTRY label exists.
+ */
+bool has_entry_labels(label *label_list);
+
+/**
+ * Checks if any external label was used.
+ *
+ * @param ext_list List of external labels.
+ * @return True if at least one usage was recorded.
+ */
+bool has_extern_usages(external_label *ext_list);
+
 
 /* ========== Translate base 4 functions ========== */
 
@@ -0,0 +1,13 @@
+MAIN: mov M1[r2][r7],LENGTH 
+add r2,STR 
+LOOP: jmp END 
+incdec
+setr(#-5, r3)
+copy_cell(M1, r4)
+    bne LOOP 
+
+END:  stop 
+STR:  .string "abcdef" 
+LENGTH: .data 6,-9,15 
+K:  .data 22 
+M1:  .mat  [2][2]  1,2,3,4
@@ -0,0 +1,25 @@
+MAIN: mov M1[r2][r7],LENGTH 
+add r2,STR 
+mcro  a_mc(target, reg)  
+    mov M1[%reg][%reg],%reg 
+    bne %target 
+mcroend  
+mcro  no_args()  
+    inc K 
+mcroend  
+LOOP: jmp END 
+prn #-5 
+a_mc(LOOP, r3)
+a_mc( END , r1 )
+no_args()
+no_args
+mcro  keep(x)  
+    prn #%x 
+mcroend  
+keep(7)
+
+END:  stop 
+STR:  .string "abcdef" 
+LENGTH: .data 6,-9,15 
+K:  .data 22 
+M1:  .mat  [2][2]  1,2,3,4
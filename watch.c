@@ -0,0 +1,177 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+#include <setjmp.h>
+#include <sys/inotify.h>
+#include "watch.h"
+
+/*
+ * Runs one file on the warm table, like the command line loop does.
+ * A fatal error (a source that is missing or unreadable, after a delete or a rename)
+ * jumps back here like in the server, so it ends the file instead of the watch.
+ */
+void reassemble_file(assembler_table *assembler, char *filename)
+{
+    jmp_buf recovery;
+
+    set_fatal_recovery(&recovery);
+
+    if (setjmp(recovery) != 0)
+    {
+        /* The table may be left in the middle of the file */
+        abandon_pre_proc(assembler);
+        reset_assembler_table(assembler, "");
+        printf("Error processing file: %s\n", filename);
+    }
+    else if (!process_file_in_table(assembler, filename))
+    {
+        printf("Error processing file: %s\n", filename);
+    }
+
+    set_fatal_recovery(NULL);
+    fflush(stdout);
+}
+
+/*
+ * Watches the directory of the file rather than the file itself:
+ * editors often save by writing a new file and renaming it over the old one,
+ * which would silently end a watch on the old file.
+ */
+bool add_file_watch(int inotify_fd, watched_file *watched, char *filename)
+{
+    char directory[MAX_LINE_LENGTH];
+    char *slash = strrchr(filename, '/');
+
+    watched->filename = filename;
+    watched->changed = false;
+
+    if (strlen(filename) > MAX_LABEL_LENGTH)
+    {
+        watched->watch_descriptor = -1;
+        return true; /* Only reported by process_file_in_table(), there is nothing to watch */
+    }
+
+    if (slash == NULL)
+    {
+        strcpy(directory, ".");
+        add_ending_to_string(watched->source_name, filename, ".as");
+    }
+    else
+    {
+        strncpy(directory, filename, slash - filename);
+        directory[slash - filename] = '\0';
+        if (directory[0] == '\0')
+        {
+            strcpy(directory, "/");
+        }
+        add_ending_to_string(watched->source_name, slash + 1, ".as");
+    }
+
+    /* Watching the same directory twice returns the same descriptor */
+    watched->watch_descriptor = inotify_add_watch(inotify_fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+
+    return watched->watch_descriptor != -1;
+}
+
+/*
+ * Marks every file that an event names. The assembler's own outputs (.am, .ob, ...)
+ * live in the same directories, but they never match a source name.
+ */
+bool read_watch_events(int inotify_fd, watched_file *watched, int file_count)
+{
+    /* The events are read as structs, so the buffer is aligned like one
+       (the kernel pads every event to keep the next one aligned) */
+    union
+    {
+        char bytes[WATCH_EVENT_BUFFER];
+        struct inotify_event event;
+    } buffer;
+    struct inotify_event *event;
+    long length, offset;
+    int i;
+
+    length = read(inotify_fd, buffer.bytes, sizeof(buffer.bytes));
+    if (length <= 0)
+    {
+        return false;
+    }
+
+    for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len)
+    {
+        event = (struct inotify_event *)(buffer.bytes + offset);
+
+        if (event->len == 0)
+        {
+            continue;
+        }
+
+        for (i = 0; i < file_count; i++)
+        {
+            if (watched[i].watch_descriptor == event->wd && strcmp(watched[i].source_name, event->name) == 0)
+            {
+                watched[i].changed = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Assembles everything once, then waits for saves. Events that arrive together
+ * (an editor often writes a file in several steps) cause a single reassembly per file.
+ */
+int run_watch(char **files, int file_count)
+{
+    watched_file *watched = my_malloc(sizeof(watched_file) * file_count);
+    assembler_table *assembler;
+    int inotify_fd, i;
+
+    inotify_fd = inotify_init();
+    if (inotify_fd == -1)
+    {
+        printf("Error: Failed to start watching files.\n");
+        free(watched);
+        return 1;
+    }
+
+    /* The files are saved while they may be read, and a mapped file can't shrink safely */
+    set_source_mapping(false);
+
+    for (i = 0; i < file_count; i++)
+    {
+        if (!add_file_watch(inotify_fd, &watched[i], files[i]))
+        {
+            printf("Error: Failed to watch file: %s\n", files[i]);
+            close(inotify_fd);
+            free(watched);
+            return 1;
+        }
+    }
+
+    /* The table stays hot between runs */
+    assembler = initialize_assembler_table("");
+
+    for (i = 0; i < file_count; i++)
+    {
+        reassemble_file(assembler, files[i]);
+    }
+
+    while (read_watch_events(inotify_fd, watched, file_count))
+    {
+        for (i = 0; i < file_count; i++)
+        {
+            if (watched[i].changed)
+            {
+                watched[i].changed = false;
+                reassemble_file(assembler, watched[i].filename);
+            }
+        }
+    }
+
+    free_assembler_table(assembler);
+    close(inotify_fd);
+    free(watched);
+
+    return 1;
+}
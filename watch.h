@@ -0,0 +1,59 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "assembler.h"
+
+/* ============================ Watch mode ================================== */
+
+/* Size of the buffer inotify events are read into */
+#define WATCH_EVENT_BUFFER 4096
+
+/* One watched source: its name, and the directory watch it belongs to */
+typedef struct watched_file
+{
+    char *filename;                    /* The file name as given (without extension) */
+    char source_name[MAX_LINE_LENGTH]; /* Name of the .as file inside its directory */
+    int watch_descriptor;              /* inotify watch of the file's directory */
+    bool changed;                      /* Set when an event for the file arrived */
+} watched_file;
+
+/**
+ * Assembles the given files once, then watches their .as files with inotify
+ * and reassembles every file that is saved, until the process is killed.
+ * The same assembler table is reused for every run.
+ *
+ * @param files The files to watch (without extension).
+ * @param file_count Number of files.
+ * @return 1 if the files could not be watched (the function doesn't return otherwise).
+ */
+int run_watch(char **files, int file_count);
+
+/**
+ * Adds a watch on the directory of a file, and fills its watched_file entry.
+ *
+ * @param inotify_fd The inotify instance.
+ * @param watched The entry to fill.
+ * @param filename The file name (without extension).
+ * @return true if the directory could be watched.
+ */
+bool add_file_watch(int inotify_fd, watched_file *watched, char *filename);
+
+/**
+ * Reads the pending inotify events, and marks the files they refer to as changed.
+ *
+ * @param inotify_fd The inotify instance.
+ * @param watched The watched files.
+ * @param file_count Number of files.
+ * @return false if reading failed.
+ */
+bool read_watch_events(int inotify_fd, watched_file *watched, int file_count);
+
+/**
+ * Reassembles the given file on the warm table, and prints its messages.
+ *
+ * @param assembler The reused table.
+ * @param filename The file name (without extension).
+ */
+void reassemble_file(assembler_table *assembler, char *filename);
+
+#endif /* WATCH_H */